@@ -0,0 +1,498 @@
+// Copyright 2024, Patrick Bene
+
+// Report timing benchmark. Reads REPORT_ID_BUTTONS reports straight from
+// hidraw, timestamps them with CLOCK_MONOTONIC, and histograms the
+// inter-report intervals and, from the pad's own timestamps, how late each
+// report arrived compared to the fastest one around it.
+
+// STD
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <math.h>
+#include <stddef.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Linux
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "protocol.h"
+
+enum
+{
+  REPORT_ID_BUTTONS = 1,
+  REPORT_ID_FEATURES,
+  REPORT_ID_KEYBOARD,
+  REPORT_ID_COMMAND,
+  REPORT_ID_COUNT
+};
+
+// Device timestamps are estimated against the host clock over windows
+// this long, which keeps crystal drift between the two out of the result.
+#define DRIFT_WINDOW_US 1000000
+
+typedef struct
+{
+    uint64_t host_us;
+    uint16_t buttons;
+    bool has_device_us;
+    uint16_t device_us;
+    double latency_us;
+} sample_t;
+
+static sample_t* samples = NULL;
+static size_t num_samples = 0;
+static size_t max_samples = 0;
+
+static volatile sig_atomic_t stop = false;
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    stop = true;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Finds the first hidraw node belonging to a Pubby Pad.
+static bool find_device(char* path, size_t size)
+{
+    glob_t g;
+    bool found = false;
+
+    if(glob("/sys/class/hidraw/hidraw*/device/uevent", 0, NULL, &g) != 0)
+        return false;
+
+    for(size_t i = 0; i < g.gl_pathc && !found; ++i)
+    {
+        FILE* fp = fopen(g.gl_pathv[i], "r");
+        if(!fp)
+            continue;
+
+        char line[256];
+        while(fgets(line, sizeof(line), fp))
+        {
+            if(strncmp(line, "HID_ID=0003:000016C0:000027D9", 29) == 0)
+            {
+                char const* name = g.gl_pathv[i] + strlen("/sys/class/hidraw/");
+                snprintf(path, size, "/dev/%.*s", (int)strcspn(name, "/"), name);
+                found = true;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    globfree(&g);
+    return found;
+}
+
+// Runs a single command protocol operation, returning its data length or -1.
+static int command(int fd, uint8_t op, uint8_t arg, void const* data, uint8_t len, uint8_t* out)
+{
+    uint8_t buf[1 + COMMAND_REPORT_SIZE] = { REPORT_ID_COMMAND, COMMAND_VERSION, 1, op, arg, len };
+
+    if(len)
+        memcpy(buf + 6, data, len);
+    if(ioctl(fd, HIDIOCSFEATURE(sizeof(buf)), buf) < 0)
+        return -1;
+
+    memset(buf, 0, sizeof(buf));
+    buf[0] = REPORT_ID_COMMAND;
+    if(ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf) < 0)
+        return -1;
+
+    // Report ID, header, then opcode, status, length.
+    if(buf[2] != 1 || buf[4] != STATUS_OK)
+        return -1;
+    if(out)
+        memcpy(out, buf + 6, buf[5]);
+    return buf[5];
+}
+
+static void add_sample(sample_t const* sample)
+{
+    if(num_samples == max_samples)
+    {
+        max_samples = max_samples ? max_samples * 2 : 4096;
+        samples = realloc(samples, max_samples * sizeof(sample_t));
+        if(!samples)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    samples[num_samples++] = *sample;
+}
+
+// Host-minus-device time can only be measured up to a constant offset that
+// drifts slowly. Fit a line through the smallest difference in each window
+// and measure every report against it, so latency is the extra time a
+// report took compared to the fastest reports around it.
+static bool compute_latency(void)
+{
+    double* diff = malloc(num_samples * sizeof(double));
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    unsigned n = 0;
+    bool any = false;
+
+    if(!diff)
+        return false;
+
+    // Unwrap the 16-bit device clock against the host clock.
+    double prev = 0;
+    for(size_t i = 0; i < num_samples; ++i)
+    {
+        if(!samples[i].has_device_us)
+            continue;
+
+        double d = (uint16_t)(samples[i].host_us - samples[i].device_us);
+        if(any)
+        {
+            while(d - prev > 32768)
+                d -= 65536;
+            while(prev - d > 32768)
+                d += 65536;
+        }
+        diff[i] = prev = d;
+        any = true;
+    }
+
+    if(!any)
+    {
+        free(diff);
+        return false;
+    }
+
+    uint64_t const start = samples[0].host_us;
+    for(size_t i = 0; i < num_samples;)
+    {
+        uint64_t const window = (samples[i].host_us - start) / DRIFT_WINDOW_US;
+        double best = INFINITY;
+        double best_x = 0;
+
+        for(; i < num_samples && (samples[i].host_us - start) / DRIFT_WINDOW_US == window; ++i)
+        {
+            if(samples[i].has_device_us && diff[i] < best)
+            {
+                best = diff[i];
+                best_x = samples[i].host_us - start;
+            }
+        }
+
+        if(best != INFINITY)
+        {
+            sx += best_x;
+            sy += best;
+            sxx += best_x * best_x;
+            sxy += best_x * best;
+            ++n;
+        }
+    }
+
+    double slope = 0;
+    double const denom = n * sxx - sx * sx;
+    if(n > 1 && denom != 0)
+        slope = (n * sxy - sx * sy) / denom;
+    double const intercept = (sy - slope * sx) / n;
+
+    for(size_t i = 0; i < num_samples; ++i)
+    {
+        if(samples[i].has_device_us)
+            samples[i].latency_us = diff[i] - (intercept + slope * (samples[i].host_us - start));
+    }
+
+    free(diff);
+    return true;
+}
+
+static int compare_double(void const* a, void const* b)
+{
+    double const x = *(double const*)a;
+    double const y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+static void print_histogram(char const* title, double* values, size_t count, unsigned bucket_us)
+{
+    if(count == 0)
+        return;
+
+    qsort(values, count, sizeof(double), compare_double);
+
+    double sum = 0, sum_sq = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        sum += values[i];
+        sum_sq += values[i] * values[i];
+    }
+    double const mean = sum / count;
+    double const stddev = sqrt(fmax(sum_sq / count - mean * mean, 0));
+
+    printf("%s (us): n=%zu min=%.0f mean=%.1f stddev=%.1f p50=%.0f p99=%.0f p99.9=%.0f max=%.0f\n",
+           title, count, values[0], mean, stddev,
+           values[count / 2], values[count * 99 / 100], values[count * 999 / 1000], values[count - 1]);
+
+    long const first = (long)floor(values[0] / bucket_us);
+    long const last = (long)floor(values[count - 1] / bucket_us);
+    size_t peak = 0;
+    size_t j = 0;
+
+    size_t* const buckets = calloc(last - first + 1, sizeof(size_t));
+    if(!buckets)
+        return;
+    for(size_t i = 0; i < count; ++i)
+    {
+        long const b = (long)floor(values[i] / bucket_us) - first;
+        if(++buckets[b] > peak)
+            peak = buckets[b];
+    }
+
+    for(long b = first; b <= last; ++b, ++j)
+    {
+        if(!buckets[j])
+            continue;
+        printf("  %7ld..%-7ld %8zu ", b * (long)bucket_us, (b + 1) * (long)bucket_us, buckets[j]);
+        for(size_t k = 0; k < buckets[j] * 50 / peak; ++k)
+            putchar('#');
+        putchar('\n');
+    }
+
+    free(buckets);
+}
+
+static void usage(char const* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-d /dev/hidrawN] [-t seconds] [-o out.csv] [-b bucket_us] [-s]\n"
+            "  -d  hidraw node of the pad (default: first Pubby Pad found)\n"
+            "  -t  run time in seconds (default: 10, stop early with Ctrl-C)\n"
+            "  -o  write every report to a CSV file\n"
+            "  -b  histogram bucket width in microseconds (default: 50)\n"
+            "  -s  stream mode: have the pad report every frame during the run\n",
+            argv0);
+}
+
+int main(int argc, char** argv)
+{
+    char path[64] = {};
+    char const* csv_path = NULL;
+    unsigned seconds = 10;
+    unsigned bucket_us = 50;
+    bool stream = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "d:t:o:b:sh")) != -1)
+    {
+        switch(opt)
+        {
+        case 'd': snprintf(path, sizeof(path), "%s", optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'o': csv_path = optarg; break;
+        case 'b': bucket_us = atoi(optarg); break;
+        case 's': stream = true; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(bucket_us == 0)
+        bucket_us = 1;
+
+    if(!path[0] && !find_device(path, sizeof(path)))
+    {
+        fprintf(stderr, "No Pubby Pad found.\n");
+        return EXIT_FAILURE;
+    }
+
+    int const fd = open(path, O_RDWR);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Timings the pad took at its last power-up, if the firmware has them.
+    uint8_t data[COMMAND_DATA_MAX];
+    if(command(fd, OP_GET_STATS, offsetof(struct pad_stats, boot_enum_us), NULL, 0, data) >= 2 * (int)sizeof(uint32_t))
+    {
+        uint32_t enum_us, report_us;
+        memcpy(&enum_us, data, sizeof(enum_us));
+        memcpy(&report_us, data + sizeof(enum_us), sizeof(report_us));
+        printf("Boot: enumerated %.1f ms after reset, first report %.1f ms after reset\n",
+               enum_us / 1000.0, report_us / 1000.0);
+    }
+
+    uint32_t cycles[3]; // Scalar, packed lanes, interpolator.
+    if(command(fd, OP_GET_STATS, offsetof(struct pad_stats, filter_scalar_cycles), NULL, 0, data) >= (int)sizeof(cycles))
+    {
+        memcpy(cycles, data, sizeof(cycles));
+        printf("Filter pass: %u cycles scalar, %u packed lanes, %u interpolator\n",
+               (unsigned)cycles[0], (unsigned)cycles[1], (unsigned)cycles[2]);
+    }
+
+    // The lights' share of a pass, and how soon a press shows.
+    uint32_t lights[2]; // Enqueue cycles, edge to frame.
+    if(command(fd, OP_GET_STATS, offsetof(struct pad_stats, light_push_cycles), NULL, 0, data) >= (int)sizeof(lights))
+    {
+        memcpy(lights, data, sizeof(lights));
+        printf("Lights: %u cycles per edge queued, last frame started %u us after its edge\n",
+               (unsigned)lights[0], (unsigned)lights[1]);
+    }
+
+    uint32_t queue[2]; // Overflows, coalesced edges.
+    if(command(fd, OP_GET_STATS, offsetof(struct pad_stats, report_overflows), NULL, 0, data) >= (int)sizeof(queue))
+    {
+        memcpy(queue, data, sizeof(queue));
+        printf("Report queue: filled up %u times, %u edges coalesced\n", (unsigned)queue[0], (unsigned)queue[1]);
+    }
+
+    // What the excitation mode costs, to pick one per cabinet.
+    uint32_t sampling[2]; // Pass time, noise.
+    struct excitation_field excitation;
+    if(command(fd, OP_GET_STATS, offsetof(struct pad_stats, sample_pass_us), NULL, 0, data) >= (int)sizeof(sampling)
+       && command(fd, OP_GET, FIELD_EXCITATION, NULL, 0, (uint8_t*)&excitation) == sizeof(excitation))
+    {
+        memcpy(sampling, data, sizeof(sampling));
+        printf("Sampling: %u us per pass, noise %.2f codes, sensors %s",
+               (unsigned)sampling[0], sampling[1] / 16.0, excitation.mode == EXCITE_PULSED ? "pulsed" : "always on");
+        if(excitation.mode == EXCITE_PULSED)
+            printf(" with %u us to settle", excitation.settle_us);
+        printf("\n");
+    }
+
+    // How often the schedule decided each button on a fresh reading over
+    // the last second, for the buttons the pad has.
+    struct pad_info info;
+    uint32_t rates[sizeof(((struct pad_stats*)0)->decision_rate_hz) / sizeof(uint32_t)];
+    if(command(fd, OP_GET, FIELD_INFO, NULL, 0, (uint8_t*)&info) == sizeof(info)
+       && command(fd, OP_GET_STATS, offsetof(struct pad_stats, decision_rate_hz), NULL, 0, data) >= (int)sizeof(rates))
+    {
+        memcpy(rates, data, sizeof(rates));
+        printf("Decision rates:");
+        for(unsigned i = 0; i < info.num_buttons && i < sizeof(rates) / sizeof(*rates); ++i)
+            printf(" %u", (unsigned)rates[i]);
+        printf(" per s\n");
+    }
+
+    // FIELD_STREAM isn't saved, so a killed run leaves the pad as it was
+    // after a replug, and the idle commit never writes mid-run.
+    if(stream)
+    {
+        uint8_t const on = 1;
+        if(command(fd, OP_SET, FIELD_STREAM, &on, 1, NULL) < 0)
+        {
+            fprintf(stderr, "Unable to turn on streaming; old firmware?\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    fprintf(stderr, "Reading %s for %u s...\n", path, seconds);
+
+    uint64_t const end = now_us() + (uint64_t)seconds * 1000000;
+    while(!stop && now_us() < end)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        uint8_t buf[64];
+        ssize_t const len = read(fd, buf, sizeof(buf));
+        uint64_t const host_us = now_us();
+
+        if(len < 1 + (ssize_t)sizeof(struct buttons_report) || buf[0] != REPORT_ID_BUTTONS)
+            continue;
+
+        struct buttons_report report;
+        memcpy(&report, buf + 1, sizeof(report));
+
+        sample_t const sample =
+        {
+            .host_us = host_us,
+            .buttons = report.buttons[0] | (report.buttons[1] << 8),
+            .has_device_us = true,
+            .device_us = report.time_us[0] | (report.time_us[1] << 8),
+        };
+        add_sample(&sample);
+    }
+
+    if(stream)
+    {
+        uint8_t const off = 0;
+        command(fd, OP_SET, FIELD_STREAM, &off, 1, NULL);
+    }
+    close(fd);
+
+    if(num_samples < 2)
+    {
+        fprintf(stderr, "Got %zu reports; press some panels or use -s.\n", num_samples);
+        return EXIT_FAILURE;
+    }
+
+    bool const has_latency = compute_latency();
+
+    if(csv_path)
+    {
+        FILE* fp = fopen(csv_path, "w");
+        if(!fp)
+        {
+            fprintf(stderr, "Unable to write %s: %s\n", csv_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        fprintf(fp, "host_us,interval_us,buttons,device_us,latency_us\n");
+        for(size_t i = 0; i < num_samples; ++i)
+        {
+            fprintf(fp, "%llu,%llu,%u,",
+                    (unsigned long long)(samples[i].host_us - samples[0].host_us),
+                    (unsigned long long)(i ? samples[i].host_us - samples[i-1].host_us : 0),
+                    samples[i].buttons);
+            if(samples[i].has_device_us)
+                fprintf(fp, "%u,%.1f\n", samples[i].device_us, samples[i].latency_us);
+            else
+                fprintf(fp, ",\n");
+        }
+        fclose(fp);
+    }
+
+    double* values = malloc(num_samples * sizeof(double));
+    if(!values)
+        return EXIT_FAILURE;
+
+    for(size_t i = 1; i < num_samples; ++i)
+        values[i - 1] = samples[i].host_us - samples[i - 1].host_us;
+    print_histogram("Interval", values, num_samples - 1, bucket_us);
+
+    if(has_latency)
+    {
+        size_t count = 0;
+        for(size_t i = 0; i < num_samples; ++i)
+            if(samples[i].has_device_us)
+                values[count++] = samples[i].latency_us;
+        print_histogram("Latency over best case", values, count, bucket_us);
+    }
+    else
+        printf("No device timestamps in the reports; latency needs newer firmware.\n");
+
+    free(values);
+    free(samples);
+    return EXIT_SUCCESS;
+}
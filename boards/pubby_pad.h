@@ -0,0 +1,24 @@
+// Pubby Pad: four FSR panels on ADC inputs 0-3.
+
+#ifndef BOARDS_PUBBY_PAD_H_
+#define BOARDS_PUBBY_PAD_H_
+
+#define PAD_NUM_BUTTONS 4
+
+// ADC input of each button, 0-3 for GPIO 26-29.
+#define PAD_ADC_INPUTS { 0, 1, 2, 3 }
+
+#define PAD_LED_PIN 16    // WS2812 data.
+#define PAD_PANEL_LEDS 1  // WS2812s per panel, chained in button order.
+#define PAD_PWM_PIN 23    // Regulator mode: high for PWM, low for power saving.
+#define PAD_EXCITE_PIN 22 // FSR divider supply, on boards that switch it.
+
+// Pad link.
+#define PAD_LINK_UART uart1
+#define PAD_LINK_TX_PIN 4
+#define PAD_LINK_RX_PIN 5
+
+// Keyboard usage of each button until one is set.
+#define PAD_DEFAULT_KEYS { HID_KEY_ARROW_LEFT, HID_KEY_ARROW_DOWN, HID_KEY_ARROW_UP, HID_KEY_ARROW_RIGHT }
+
+#endif /* BOARDS_PUBBY_PAD_H_ */
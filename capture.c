@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "capture.h"
+
+#define CAPTURE_FRAMES 1024 // Must be a power of two.
+#define CAPTURE_POST_FRAMES (CAPTURE_FRAMES / 4)
+#define NUM_CHUNKS ((CAPTURE_FRAMES + CAPTURE_FRAMES_PER_CHUNK - 1) / CAPTURE_FRAMES_PER_CHUNK)
+
+static capture_frame_t ring[CAPTURE_FRAMES];
+static capture_frame_t scratch; // Converted into while frozen.
+static unsigned head = 0;       // Next frame to write.
+static unsigned trigger_index = 0;
+static unsigned post_remaining = 0;
+static bool converting = false; // Between capture_begin() and capture_end().
+
+static uint8_t state = CAPTURE_ARMED;
+static uint8_t reason = 0;
+static unsigned read_chunk = 0;
+
+static uint32_t press_us[NUM_BUTTONS];
+
+struct capture_triggers_field capture_triggers =
+{
+    .triggers = CAPTURE_TRIGGER_SHORT | CAPTURE_TRIGGER_HOST,
+    .short_edge_ms = 30,
+};
+
+capture_frame_t* capture_begin(void)
+{
+    capture_frame_t* const frame = (state == CAPTURE_FROZEN) ? &scratch : &ring[head];
+    frame->time_us = time_us_32();
+    converting = true;
+    return frame;
+}
+
+void capture_end(void)
+{
+    converting = false;
+    if(state == CAPTURE_FROZEN)
+        return;
+
+    head = (head + 1) & (CAPTURE_FRAMES - 1);
+
+    if(state == CAPTURE_TRIGGERED && --post_remaining == 0)
+    {
+        state = CAPTURE_FROZEN;
+        read_chunk = 0;
+    }
+}
+
+void capture_trigger(uint8_t source)
+{
+    if(state != CAPTURE_ARMED || !(capture_triggers.triggers & source))
+        return;
+
+    state = CAPTURE_TRIGGERED;
+    reason = source;
+    trigger_index = (head - !converting) & (CAPTURE_FRAMES - 1);
+    post_remaining = CAPTURE_POST_FRAMES;
+}
+
+void capture_edges(buttons_t prev, buttons_t buttons, uint32_t sample_us)
+{
+    buttons_t const changed = prev ^ buttons;
+    uint8_t source = CAPTURE_TRIGGER_EDGE;
+
+    if(!changed)
+        return;
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        buttons_t const button = 1 << i;
+
+        if(!(changed & button))
+            continue;
+
+        if(buttons & button)
+            press_us[i] = sample_us;
+        else if(sample_us - press_us[i] < capture_triggers.short_edge_ms * 1000u)
+            source = CAPTURE_TRIGGER_SHORT;
+    }
+
+    // Fall back to a plain edge when only plain edges are enabled.
+    if(source == CAPTURE_TRIGGER_SHORT && !(capture_triggers.triggers & CAPTURE_TRIGGER_SHORT))
+        source = CAPTURE_TRIGGER_EDGE;
+
+    capture_trigger(source);
+}
+
+void capture_read(uint8_t* buffer)
+{
+    unsigned const chunk = read_chunk;
+    unsigned const first = chunk * CAPTURE_FRAMES_PER_CHUNK;
+    unsigned frames = CAPTURE_FRAMES - first;
+    if(frames > CAPTURE_FRAMES_PER_CHUNK)
+        frames = CAPTURE_FRAMES_PER_CHUNK;
+
+    // Once frozen, 'head' is the oldest frame in the window.
+    struct capture_header const header =
+    {
+        .state = state,
+        .reason = reason,
+        .channels = NUM_BUTTONS,
+        .frames = frames,
+        .chunk = chunk,
+        .num_chunks = NUM_CHUNKS,
+        .trigger_frame = (trigger_index - head) & (CAPTURE_FRAMES - 1),
+    };
+
+    memset(buffer, 0, CAPTURE_CHUNK_SIZE);
+    memcpy(buffer, &header, sizeof(header));
+    buffer += sizeof(header);
+
+    for(unsigned i = 0; i < frames; ++i)
+    {
+        unsigned const index = (head + first + i) & (CAPTURE_FRAMES - 1);
+        memcpy(buffer, &ring[index], sizeof(capture_frame_t));
+        buffer += sizeof(capture_frame_t);
+    }
+
+    read_chunk = (chunk + 1) % NUM_CHUNKS;
+}
+
+void capture_command(uint8_t command, uint16_t value)
+{
+    switch(command)
+    {
+    case CAPTURE_CMD_SEEK:
+        if(value < NUM_CHUNKS)
+            read_chunk = value;
+        break;
+
+    case CAPTURE_CMD_TRIGGER:
+        capture_trigger(CAPTURE_TRIGGER_HOST);
+        break;
+
+    case CAPTURE_CMD_REARM:
+        state = CAPTURE_ARMED;
+        break;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pad.h"
+#include "protocol.h"
+
+// Flight recorder. The acquisition pass converts straight into a slot of
+// the recorder's ring, so recording costs no copies. When a trigger fires,
+// the ring keeps recording until the trigger sits a quarter of the way
+// from the end, then freezes until the host rearms it.
+
+typedef struct
+{
+    uint16_t time_us;
+    uint16_t held; // Channels the pass didn't convert, which read 0.
+    uint16_t raw[NUM_BUTTONS];
+} capture_frame_t;
+
+#define CAPTURE_FRAMES_PER_CHUNK ((COMMAND_DATA_MAX - sizeof(struct capture_header)) / sizeof(capture_frame_t))
+#define CAPTURE_CHUNK_SIZE (sizeof(struct capture_header) + CAPTURE_FRAMES_PER_CHUNK * sizeof(capture_frame_t))
+
+extern struct capture_triggers_field capture_triggers;
+
+// Returns the frame the current pass should convert into.
+capture_frame_t* capture_begin(void);
+void capture_end(void);
+
+// Marks the frame being converted, if a pass is under way, else the last one.
+void capture_trigger(uint8_t source);
+
+// Triggers on debounced edges, from the sample they were decided on.
+void capture_edges(buttons_t prev, buttons_t buttons, uint32_t sample_us);
+
+void capture_command(uint8_t command, uint16_t value);
+
+// Writes the next chunk of CAPTURE_CHUNK_SIZE bytes.
+void capture_read(uint8_t* buffer);
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,385 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "command.h"
+#include "protocol.h"
+#include "config.h"
+#include "capture.h"
+#include "sof.h"
+#include "curve.h"
+#include "crosstalk.h"
+#include "thermal.h"
+#include "link.h"
+#include "stats.h"
+
+#define OP_HEADER_SIZE 3
+
+typedef struct
+{
+    void* data;
+    uint8_t size;
+    bool persistent; // Part of the saved config; setting it schedules a commit.
+    bool read_only;
+    void (*changed)(void);
+} field_t;
+
+static struct pad_info const info =
+{
+    .command_version = COMMAND_VERSION,
+    .num_buttons = NUM_BUTTONS,
+};
+
+static struct sof_lock_field sof_lock_setting;
+uint8_t report_stream = 0;
+
+static void sof_lock_changed(void)
+{
+    sof_lock(sof_lock_setting.enable, sof_lock_setting.lead_min_us);
+}
+
+bool profile_switch(uint8_t slot)
+{
+    uint8_t const link_role = config.link_role;
+    if(!profile_select(slot))
+        return false;
+
+    curve_update();
+    crosstalk_update();
+    thermal_reload();
+    if(config.link_role != link_role)
+        link_init();
+    return true;
+}
+
+// The field is the active config's own slot number, so put it back
+// before switching away.
+static void profile_changed(void)
+{
+    uint8_t const slot = config.profile;
+    config.profile = profile_active();
+    profile_switch(slot);
+}
+
+_Static_assert(sizeof(debounce_config_t) == sizeof(struct debounce_field), "debounce_field must match debounce_config_t");
+
+static field_t const fields[FIELD_COUNT] =
+{
+    [FIELD_INFO]             = { (void*)&info, sizeof(info), false, true },
+    [FIELD_SENSORS]          = { sensors, sizeof(sensors), false, true },
+    [FIELD_THRESHOLDS]       = { config.thresholds, NUM_BUTTONS, true, false, thermal_update },
+    [FIELD_KEYS]             = { config.keys, NUM_BUTTONS, true },
+    [FIELD_REPORT_MODE]      = { &config.report_mode, sizeof(config.report_mode), true },
+    [FIELD_DEBOUNCE]         = { &config.debounce, sizeof(config.debounce), true },
+    [FIELD_SOF_LOCK]         = { &sof_lock_setting, sizeof(sof_lock_setting), false, false, sof_lock_changed },
+    [FIELD_CAPTURE_TRIGGERS] = { &capture_triggers, sizeof(capture_triggers) },
+    [FIELD_CURVES]           = { config.curves, NUM_BUTTONS * CURVE_KNOTS, true, false, curve_update },
+    [FIELD_LINK_ROLE]        = { &config.link_role, sizeof(config.link_role), true, false, link_init },
+    [FIELD_ADC_DISCARD]      = { &config.adc_discard, sizeof(config.adc_discard), true },
+    [FIELD_ADC_OVERSAMPLE]   = { &config.adc_oversample, sizeof(config.adc_oversample), true },
+    [FIELD_CROSSTALK]        = { config.crosstalk, CROSSTALK_SIZE(NUM_BUTTONS), true, false, crosstalk_update },
+    [FIELD_TEMP_COMP]        = { &config.temp_comp, 1 + NUM_BUTTONS, true, false, thermal_update },
+    [FIELD_TEMPERATURE]      = { &temperature, sizeof(temperature), false, true },
+    [FIELD_EXCITATION]       = { &config.excitation, sizeof(config.excitation), true },
+    [FIELD_LIGHTS]           = { &config.lights, sizeof(config.lights), true },
+    // Switching saves itself; see profile_select().
+    [FIELD_PROFILE]          = { &config.profile, sizeof(config.profile), false, false, profile_changed },
+    [FIELD_SCHEDULE]         = { &config.schedule, sizeof(config.schedule), true },
+    [FIELD_STREAM]           = { &report_stream, sizeof(report_stream) },
+};
+
+// The last accepted batch, or the operation that got a batch rejected.
+static uint8_t request[COMMAND_REPORT_SIZE];
+static uint16_t request_size = 0;
+static uint8_t rejected_op = 0;
+static uint8_t rejected_status = STATUS_OK;
+
+// Whether the firmware can act on a value SET to the field. Fields where
+// any value means something aren't listed.
+static bool value_valid(uint8_t field, uint8_t const* data)
+{
+    switch(field)
+    {
+    case FIELD_REPORT_MODE:
+        // With neither report the pad would go silent.
+        return (data[0] & (REPORT_MODE_GAMEPAD | REPORT_MODE_KEYBOARD))
+            && !(data[0] & ~(REPORT_MODE_GAMEPAD | REPORT_MODE_KEYBOARD | REPORT_MODE_STREAM));
+
+    case FIELD_DEBOUNCE:
+    {
+        struct debounce_field debounce;
+        memcpy(&debounce, data, sizeof(debounce));
+        return !(debounce.flags & ~DEBOUNCE_DEFER_RELEASE);
+    }
+
+    case FIELD_CAPTURE_TRIGGERS:
+    {
+        struct capture_triggers_field triggers;
+        memcpy(&triggers, data, sizeof(triggers));
+        return !(triggers.triggers & ~(CAPTURE_TRIGGER_EDGE | CAPTURE_TRIGGER_SHORT | CAPTURE_TRIGGER_HOST));
+    }
+
+    case FIELD_LINK_ROLE:
+        return data[0] <= LINK_SECONDARY;
+
+    case FIELD_ADC_DISCARD:
+        return data[0] <= ADC_DISCARD_MAX;
+
+    case FIELD_ADC_OVERSAMPLE:
+        return data[0] <= ADC_OVERSAMPLE_MAX;
+
+    case FIELD_EXCITATION:
+    {
+        struct excitation_field excitation;
+        memcpy(&excitation, data, sizeof(excitation));
+        return excitation.mode <= EXCITE_PULSED && excitation.settle_us <= EXCITE_SETTLE_MAX_US;
+    }
+
+    case FIELD_LIGHTS:
+    {
+        struct lights_field lights;
+        memcpy(&lights, data, sizeof(lights));
+        return lights.mode <= LIGHTS_PRESS;
+    }
+
+    case FIELD_PROFILE:
+        return data[0] < PROFILE_COUNT;
+
+    case FIELD_SCHEDULE:
+    {
+        struct schedule_field schedule;
+        memcpy(&schedule, data, sizeof(schedule));
+        return schedule.mode <= SCHEDULE_ADAPTIVE && schedule.floor <= SCHEDULE_FLOOR_MAX;
+    }
+
+    default:
+        return true;
+    }
+}
+
+// Returns how many bytes of data the operation returns,
+// or a negated STATUS_* if it's invalid.
+static int validate(uint8_t op, uint8_t arg, uint8_t const* data, uint8_t len)
+{
+    switch(op)
+    {
+    case OP_GET:
+        if(arg >= FIELD_COUNT)
+            return -STATUS_BAD_FIELD;
+        if(len != 0)
+            return -STATUS_BAD_LENGTH;
+        return fields[arg].size;
+
+    case OP_SET:
+        if(arg >= FIELD_COUNT)
+            return -STATUS_BAD_FIELD;
+        if(fields[arg].read_only)
+            return -STATUS_READ_ONLY;
+        if(len != fields[arg].size)
+            return -STATUS_BAD_LENGTH;
+        if(!value_valid(arg, data))
+            return -STATUS_BAD_VALUE;
+        return 0;
+
+    case OP_GET_STATS:
+        if(len != 0 || arg >= sizeof(stats))
+            return -STATUS_BAD_LENGTH;
+        return MIN(sizeof(stats) - arg, COMMAND_DATA_MAX);
+
+    case OP_RESET_STATS:
+    case OP_COMMIT:
+        if(len != 0)
+            return -STATUS_BAD_LENGTH;
+        return 0;
+
+    case OP_CAPTURE:
+        if(len != sizeof(uint16_t))
+            return -STATUS_BAD_LENGTH;
+        return 0;
+
+    case OP_GET_CAPTURE:
+        if(len != 0)
+            return -STATUS_BAD_LENGTH;
+        return CAPTURE_CHUNK_SIZE;
+
+    default:
+        return -STATUS_BAD_OP;
+    }
+}
+
+// The boot timings and the benchmarks run at mount are only measured
+// once, so they survive a reset.
+static void reset_stats(void)
+{
+    struct pad_stats const kept = stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.boot_enum_us = kept.boot_enum_us;
+    stats.boot_report_us = kept.boot_report_us;
+    stats.filter_scalar_cycles = kept.filter_scalar_cycles;
+    stats.filter_swar_cycles = kept.filter_swar_cycles;
+    stats.filter_interp_cycles = kept.filter_interp_cycles;
+    stats.light_push_cycles = kept.light_push_cycles;
+}
+
+static void execute(uint8_t op, uint8_t arg, uint8_t const* data)
+{
+    switch(op)
+    {
+    case OP_SET:
+        memcpy(fields[arg].data, data, fields[arg].size);
+        if(fields[arg].changed)
+            fields[arg].changed();
+        if(fields[arg].persistent)
+            config_changed();
+        break;
+
+    case OP_RESET_STATS:
+        reset_stats();
+        break;
+
+    case OP_CAPTURE:
+        capture_command(arg, data[0] | (data[1] << 8));
+        break;
+
+    case OP_COMMIT:
+        commit_config();
+        break;
+    }
+}
+
+static void reject(uint8_t op, uint8_t status)
+{
+    request_size = 0;
+    rejected_op = op;
+    rejected_status = status;
+}
+
+void command_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+    struct command_header header;
+
+    if(bufsize > sizeof(request))
+        bufsize = sizeof(request);
+    if(bufsize < sizeof(header))
+    {
+        reject(0, STATUS_BAD_LENGTH);
+        return;
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+    if(header.version != COMMAND_VERSION)
+    {
+        reject(0, STATUS_BAD_VERSION);
+        return;
+    }
+
+    // Validate everything first, so that a bad batch changes nothing.
+    unsigned in = sizeof(header);
+    unsigned out = sizeof(header);
+    for(unsigned i = 0; i < header.count; ++i)
+    {
+        if(in + OP_HEADER_SIZE > bufsize)
+        {
+            reject(0, STATUS_BAD_LENGTH);
+            return;
+        }
+
+        uint8_t const op = buffer[in];
+        uint8_t const len = buffer[in + 2];
+        if(in + OP_HEADER_SIZE + len > bufsize)
+        {
+            reject(op, STATUS_BAD_LENGTH);
+            return;
+        }
+
+        int const result = validate(op, buffer[in + 1], buffer + in + OP_HEADER_SIZE, len);
+        if(result < 0)
+        {
+            reject(op, -result);
+            return;
+        }
+
+        in += OP_HEADER_SIZE + len;
+        out += OP_HEADER_SIZE + result;
+
+        if(out > COMMAND_REPORT_SIZE)
+        {
+            reject(op, STATUS_NO_SPACE);
+            return;
+        }
+    }
+
+    memcpy(request, buffer, in);
+    request_size = in;
+    rejected_status = STATUS_OK;
+
+    for(unsigned i = sizeof(header); i < in; i += OP_HEADER_SIZE + request[i + 2])
+        execute(request[i], request[i + 1], request + i + OP_HEADER_SIZE);
+}
+
+uint16_t command_get_report(uint8_t* buffer, uint16_t reqlen)
+{
+    if(reqlen < COMMAND_REPORT_SIZE)
+        return 0;
+
+    memset(buffer, 0, COMMAND_REPORT_SIZE);
+
+    struct command_header header = { .version = COMMAND_VERSION };
+    uint8_t* out = buffer + sizeof(header);
+
+    if(rejected_status != STATUS_OK)
+    {
+        header.count = 1;
+        out[0] = rejected_op;
+        out[1] = rejected_status;
+    }
+    else if(request_size)
+    {
+        memcpy(&header, request, sizeof(header));
+
+        for(unsigned i = sizeof(header); i < request_size; i += OP_HEADER_SIZE + request[i + 2])
+        {
+            uint8_t const op = request[i];
+            uint8_t const arg = request[i + 1];
+            int const len = validate(op, arg, request + i + OP_HEADER_SIZE, request[i + 2]);
+
+            out[0] = op;
+            out[1] = STATUS_OK;
+            out[2] = len;
+
+            if(op == OP_GET)
+                memcpy(out + OP_HEADER_SIZE, fields[arg].data, len);
+            else if(op == OP_GET_STATS)
+                memcpy(out + OP_HEADER_SIZE, (uint8_t const*)&stats + arg, len);
+            else if(op == OP_GET_CAPTURE)
+                capture_read(out + OP_HEADER_SIZE);
+
+            out += OP_HEADER_SIZE + len;
+        }
+    }
+
+    memcpy(buffer, &header, sizeof(header));
+    return COMMAND_REPORT_SIZE;
+}
+
+uint16_t features_get_report(uint8_t* buffer, uint16_t reqlen)
+{
+    if(reqlen < 2 * NUM_BUTTONS)
+        return 0;
+
+    memcpy(buffer, config.thresholds, NUM_BUTTONS);
+    memcpy(buffer + NUM_BUTTONS, sensors, NUM_BUTTONS);
+    return 2 * NUM_BUTTONS;
+}
+
+void features_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+    if(bufsize < NUM_BUTTONS)
+        return;
+
+    int const cmp = memcmp(config.thresholds, buffer, NUM_BUTTONS);
+    memcpy(config.thresholds, buffer, NUM_BUTTONS);
+    thermal_update();
+    if(cmp != 0)
+        config_changed();
+}
@@ -0,0 +1,26 @@
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Batched command protocol carried by REPORT_ID_COMMAND.
+// See protocol.h for the wire format.
+
+void command_set_report(uint8_t const* buffer, uint16_t bufsize);
+uint16_t command_get_report(uint8_t* buffer, uint16_t reqlen);
+
+// Legacy REPORT_ID_FEATURES: the thresholds, then the sensors.
+// Changed thresholds are saved by the idle commit.
+uint16_t features_get_report(uint8_t* buffer, uint16_t reqlen);
+void features_set_report(uint8_t const* buffer, uint16_t bufsize);
+
+// FIELD_STREAM: report every frame, like REPORT_MODE_STREAM, without
+// touching the saved report mode.
+extern uint8_t report_stream;
+
+// Switches to another profile and updates everything derived from the
+// config. Returns false if there's no such profile.
+bool profile_switch(uint8_t slot);
+
+#endif /* COMMAND_H_ */
@@ -0,0 +1,313 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "tusb.h"
+
+#include "config.h"
+#include "protocol.h"
+
+#define FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define FLASH_ADDR ((uint8_t*)(XIP_BASE + FLASH_OFFSET))
+
+// The first page of the sector indexes the records in the pages after it:
+// a magic number, then a bitmap with a bit cleared for every record
+// written. Flash bits can be cleared without an erase, so the index is
+// reprogrammed in place and the newest record is found without a scan.
+#define INDEX_MAGIC 0x32584950 // "PIX2"
+#define INDEX_MAGIC_V2 0x58444950 // "PIDX", indexing CONFIG_V2_SIZE records.
+#define RECORDS_ADDR (FLASH_ADDR + FLASH_PAGE_SIZE)
+#define MAX_RECORDS ((FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE) / sizeof(pad_config_t))
+#define MAX_RECORDS_V2 ((FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE) / CONFIG_V2_SIZE)
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t free[(MAX_RECORDS_V2 + 7) / 8]; // Cleared from bit 0 up. Sized for either record size.
+} config_index_t;
+
+#define FLASH_INDEX ((config_index_t const*)FLASH_ADDR)
+
+_Static_assert(FLASH_PAGE_SIZE % sizeof(pad_config_t) == 0, "Config records must tile a flash page");
+_Static_assert(offsetof(pad_config_t, curves) == CONFIG_V1_SIZE, "Older records must be a prefix of the config");
+_Static_assert(offsetof(pad_config_t, temp_comp) == CONFIG_V2_SIZE, "Older records must be a prefix of the config");
+
+pad_config_t config;
+
+// Every profile, with unsaved changes. The active one is edited in
+// 'config' and copied back when switching away or saving.
+static pad_config_t profiles[PROFILE_COUNT];
+static uint8_t active = 0;
+
+static bool dirty = false; // Changed since the last commit.
+static uint32_t changed_us = 0;
+
+static uint8_t const default_keys[] = PAD_DEFAULT_KEYS;
+
+static bool is_blank(uint8_t const* data, unsigned size)
+{
+    for(unsigned i = 0; i < size; ++i)
+        if(data[i] != 0xFF)
+            return false;
+    return true;
+}
+
+// Returns the offset of the first blank record.
+// Only used for sectors written before the index.
+static int find_flash_offset(unsigned record_size)
+{
+    for(int i = 0; i < FLASH_SECTOR_SIZE; i += record_size)
+        if(is_blank(FLASH_ADDR + i, record_size))
+            return i;
+
+    return FLASH_SECTOR_SIZE;
+}
+
+// Returns how many records the index lists,
+// or -1 if the sector has no index with this magic.
+static int count_records(uint32_t magic)
+{
+    if(FLASH_INDEX->magic != magic)
+        return -1;
+
+    int count = 0;
+    for(unsigned i = 0; i < sizeof(FLASH_INDEX->free); ++i)
+    {
+        uint8_t const bits = FLASH_INDEX->free[i];
+        if(bits)
+            return count + __builtin_ctz(bits);
+        count += 8;
+    }
+
+    return count;
+}
+
+// Returns the newest indexed record, or NULL.
+static pad_config_t const* stored_config(void)
+{
+    int const count = count_records(INDEX_MAGIC);
+    if(count <= 0)
+        return NULL;
+
+    pad_config_t const* const stored = (pad_config_t const*)(RECORDS_ADDR + (count - 1) * sizeof(config));
+    return stored->magic == CONFIG_MAGIC ? stored : NULL;
+}
+
+// Returns the newest indexed record of a profile, or NULL.
+static pad_config_t const* stored_profile(uint8_t slot)
+{
+    pad_config_t const* const records = (pad_config_t const*)RECORDS_ADDR;
+    for(int i = count_records(INDEX_MAGIC) - 1; i >= 0; --i)
+        if(records[i].magic == CONFIG_MAGIC && records[i].profile == slot)
+            return &records[i];
+    return NULL;
+}
+
+// Loads the newest record into config, migrating older formats.
+static void load_config(void)
+{
+    memset(&config, 0, sizeof(config));
+    config.magic = CONFIG_MAGIC;
+    config.report_mode = REPORT_MODE_GAMEPAD;
+    memset(config.thresholds, 127, NUM_BUTTONS);
+    for(int i = 0; i < NUM_BUTTONS && i < (int)sizeof(default_keys); ++i)
+        config.keys[i] = default_keys[i];
+    config.debounce.min_press = 8;   // 2 ms
+    config.debounce.min_release = 8; // 2 ms
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        for(int k = 0; k < CURVE_KNOTS; ++k)
+            config.curves[i][k] = MIN(k * CURVE_STEP, 255); // Linear
+    config.lights.mode = LIGHTS_PRESS;
+    config.lights.fade_time = 15; // 150 ms
+    memset(config.lights.color, 0x40, sizeof(config.lights.color));
+    config.schedule.floor = 4;
+    config.schedule.near = 16;
+    config.schedule.motion = 4;
+
+    if(count_records(INDEX_MAGIC) >= 0)
+    {
+        pad_config_t const* const stored = stored_config();
+        if(stored)
+            memcpy(&config, stored, sizeof(config));
+        return;
+    }
+
+    // Older sectors are rewritten in the current format by the next save.
+    // Their records are a prefix of the config; the rest keeps the defaults.
+    int const v2_count = count_records(INDEX_MAGIC_V2);
+    if(v2_count >= 0)
+    {
+        uint8_t const* const v2 = RECORDS_ADDR + (v2_count - 1) * CONFIG_V2_SIZE;
+        if(v2_count > 0 && v2[0] == (CONFIG_MAGIC_V2 & 0xFF) && v2[1] == (CONFIG_MAGIC_V2 >> 8))
+        {
+            memcpy(&config, v2, CONFIG_V2_SIZE);
+            config.magic = CONFIG_MAGIC;
+        }
+        return;
+    }
+
+    // The sector predates the index.
+    int const offset = find_flash_offset(CONFIG_V2_SIZE);
+    if(offset == 0)
+        return;
+
+    uint8_t const* const v2 = FLASH_ADDR + offset - CONFIG_V2_SIZE;
+    if(v2[0] == (CONFIG_MAGIC_V2 & 0xFF) && v2[1] == (CONFIG_MAGIC_V2 >> 8))
+    {
+        memcpy(&config, v2, CONFIG_V2_SIZE);
+        config.magic = CONFIG_MAGIC;
+        return;
+    }
+
+    // Keep the default curves when migrating from older records.
+    int const v1_offset = find_flash_offset(CONFIG_V1_SIZE);
+    if(v1_offset > 0)
+    {
+        uint8_t const* const v1 = FLASH_ADDR + v1_offset - CONFIG_V1_SIZE;
+        if(v1[0] == (CONFIG_MAGIC_V1 & 0xFF) && v1[1] == (CONFIG_MAGIC_V1 >> 8))
+        {
+            memcpy(&config, v1, CONFIG_V1_SIZE);
+            config.magic = CONFIG_MAGIC;
+            return;
+        }
+    }
+
+    // Older firmware stored bare threshold records.
+    int const legacy_offset = find_flash_offset(sizeof(config.thresholds));
+    if(legacy_offset > 0)
+        memcpy(config.thresholds, FLASH_ADDR + legacy_offset - sizeof(config.thresholds), sizeof(config.thresholds));
+}
+
+void read_config(void)
+{
+    load_config();
+
+    // Records from before profiles are all profile 0. A profile that
+    // was never saved starts as a copy of the one the pad booted with.
+    active = config.profile < PROFILE_COUNT ? config.profile : 0;
+    config.profile = active;
+    for(int i = 0; i < PROFILE_COUNT; ++i)
+    {
+        pad_config_t const* const stored = stored_profile(i);
+        if(stored && i != active)
+            profiles[i] = *stored;
+        else
+        {
+            profiles[i] = config;
+            profiles[i].profile = i;
+        }
+    }
+    dirty = false;
+}
+
+uint8_t profile_active(void)
+{
+    return active;
+}
+
+bool profile_select(uint8_t slot)
+{
+    if(slot >= PROFILE_COUNT)
+        return false;
+    if(slot == active)
+        return true;
+
+    profiles[active] = config;
+    config = profiles[slot];
+    active = slot;
+
+    // The newest record decides the profile at boot, so the switch
+    // itself is saved like a change.
+    config_changed();
+    return true;
+}
+
+void config_changed(void)
+{
+    dirty = true;
+    changed_us = time_us_32();
+}
+
+void config_task(void)
+{
+    if(dirty && time_us_32() - changed_us >= CONFIG_IDLE_COMMIT_MS * 1000)
+        commit_config();
+}
+
+// Returns the slot the next record goes in,
+// or -1 if the sector has to be erased first.
+static int next_record(void)
+{
+    int const count = count_records(INDEX_MAGIC);
+    if(count < 0)
+        return is_blank(FLASH_ADDR, FLASH_SECTOR_SIZE) ? 0 : -1;
+
+    // A slot that isn't blank is left over from an interrupted save.
+    if(count >= (int)MAX_RECORDS || !is_blank(RECORDS_ADDR + count * sizeof(config), sizeof(config)))
+        return -1;
+    return count;
+}
+
+// Writes the record before indexing it, so that an interrupted save
+// leaves the previous record in charge.
+static void write_record(int slot, pad_config_t const* record)
+{
+    uint8_t page[FLASH_PAGE_SIZE];
+
+    unsigned const offset = FLASH_PAGE_SIZE + slot * sizeof(*record);
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page + (offset % FLASH_PAGE_SIZE), record, sizeof(*record));
+    flash_range_program(FLASH_OFFSET + (offset & ~(FLASH_PAGE_SIZE-1)), page, FLASH_PAGE_SIZE);
+
+    config_index_t index;
+    memset(&index, 0xFF, sizeof(index));
+    index.magic = INDEX_MAGIC;
+    for(int i = 0; i <= slot; ++i)
+        index.free[i / 8] &= ~(1 << (i % 8));
+
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &index, sizeof(index));
+    flash_range_program(FLASH_OFFSET, page, FLASH_PAGE_SIZE);
+}
+
+void commit_config(void)
+{
+    profiles[active] = config;
+    dirty = false;
+
+    bool changed[PROFILE_COUNT];
+    int others = 0;
+    for(int i = 0; i < PROFILE_COUNT; ++i)
+    {
+        pad_config_t const* const stored = stored_profile(i);
+        changed[i] = !stored || memcmp(stored, &profiles[i], sizeof(profiles[i])) != 0;
+        others += changed[i] && i != active;
+    }
+
+    pad_config_t const* const newest = stored_config();
+    if(!others && !changed[active] && newest && newest->profile == active)
+        return;
+
+    // The active profile goes last, so that it's the newest record.
+    int const count = others + 1;
+    int slot = next_record();
+    bool const erase = slot < 0 || slot + count > (int)MAX_RECORDS;
+
+    uint32_t const ints = save_and_disable_interrupts();
+
+    // Erasing takes every profile with it.
+    if(erase)
+    {
+        flash_range_erase(FLASH_OFFSET, FLASH_SECTOR_SIZE);
+        slot = 0;
+    }
+
+    for(int i = 0; i < PROFILE_COUNT; ++i)
+        if(i != active && (changed[i] || erase))
+            write_record(slot++, &profiles[i]);
+    write_record(slot, &profiles[active]);
+
+    restore_interrupts(ints);
+}
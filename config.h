@@ -0,0 +1,83 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pad.h"
+#include "debounce.h"
+#include "protocol.h"
+
+#define CONFIG_MAGIC 0x5045
+#define CONFIG_MAGIC_V2 0x5044 // 64-byte records, before temperature compensation.
+#define CONFIG_V2_SIZE 64
+#define CONFIG_MAGIC_V1 0x5043 // 16-byte records, before force curves.
+#define CONFIG_V1_SIZE 16
+
+// A coefficient per channel for the mux, then one per pair of panels.
+#define CROSSTALK_SIZE(buttons) ((buttons) + (buttons) * ((buttons) - 1) / 2)
+
+typedef struct
+{
+    int8_t reference; // Temperature the thresholds were set at, in °C.
+    int8_t slopes[MAX_BUTTONS]; // Threshold change per °C, in 1/16ths.
+} temp_comp_t;
+
+// Persistent settings. Saved as fixed-size records appended to the last
+// flash sector; the newest record wins. Per-button arrays are MAX_BUTTONS
+// long on every board, so records keep one layout; the first NUM_BUTTONS
+// entries are used.
+typedef struct
+{
+    uint16_t magic;
+    uint8_t report_mode; // REPORT_MODE_* bits
+    uint8_t adc_discard; // Was reserved, and always 0.
+    force_t thresholds[MAX_BUTTONS];
+    uint8_t keys[MAX_BUTTONS]; // Keyboard usage per button, 0 for none.
+    debounce_config_t debounce;
+    uint8_t padding[1];
+    // Fields after this point were added in CONFIG_MAGIC 0x5044.
+    uint8_t curves[MAX_BUTTONS][CURVE_KNOTS];
+    uint8_t link_role; // LINK_*
+    uint8_t adc_oversample; // 0 in records from before it, same as 1.
+    int8_t crosstalk[CROSSTALK_SIZE(MAX_BUTTONS)];
+    // Fields after this point were added in CONFIG_MAGIC 0x5045.
+    temp_comp_t temp_comp;
+    struct excitation_field excitation;
+    struct lights_field lights;
+    uint8_t profile; // Slot the record belongs to; 0 in records from before profiles.
+    struct schedule_field schedule; // All 0, a fixed schedule, in records from before it.
+    uint8_t padding_end[47];
+} pad_config_t;
+
+// Changes are staged in RAM and take effect at once. They're saved by
+// commit_config(), run for OP_COMMIT or by config_task() once the config
+// has been left alone this long.
+#define CONFIG_IDLE_COMMIT_MS 5000
+
+// The active profile. The others are cached in RAM, so switching is a copy.
+extern pad_config_t config;
+
+// Loads the newest record and caches every profile.
+void read_config(void);
+
+// Saves every profile that changed, with the active one last, since
+// the newest record picks the profile at boot. Flash writes stall the
+// CPU, with interrupts off, for a few ms.
+void commit_config(void);
+
+// Notes a change for the idle commit.
+void config_changed(void);
+
+// Commits once the config has been idle for CONFIG_IDLE_COMMIT_MS.
+// Run while no button is held, so a commit never stalls a press.
+void config_task(void);
+
+uint8_t profile_active(void);
+
+// Makes another profile active, keeping the unsaved changes of the one
+// it replaces. Returns false if 'slot' isn't below PROFILE_COUNT. Derived
+// state (curves, crosstalk, thresholds in effect) is the caller's to update.
+bool profile_select(uint8_t slot);
+
+#endif /* CONFIG_H_ */
@@ -0,0 +1,55 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "crosstalk.h"
+#include "config.h"
+
+// Coupling onto each channel from every other one through the frame,
+// and from the one converted before it through the mux, in 1/256ths.
+static int16_t matrix[NUM_BUTTONS][NUM_BUTTONS];
+static int16_t mux[NUM_BUTTONS];
+static bool enabled = false;
+
+void crosstalk_update(void)
+{
+    int8_t const* flex = config.crosstalk + NUM_BUTTONS;
+
+    memset(matrix, 0, sizeof(matrix));
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        for(int j = i + 1; j < NUM_BUTTONS; ++j)
+        {
+            matrix[i][j] = *flex;
+            matrix[j][i] = *flex;
+            ++flex;
+        }
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        mux[i] = config.crosstalk[i];
+
+    enabled = false;
+    for(int i = 0; i < CROSSTALK_SIZE(NUM_BUTTONS); ++i)
+        enabled |= config.crosstalk[i] != 0;
+}
+
+void crosstalk_apply(force_t* readings, uint8_t const* before)
+{
+    if(!enabled)
+        return;
+
+    force_t in[NUM_BUTTONS];
+    memcpy(in, readings, sizeof(in));
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        int32_t coupled = 0;
+        for(int j = 0; j < NUM_BUTTONS; ++j)
+            coupled += matrix[i][j] * in[j];
+
+        unsigned const prev = before ? before[i] : (i + NUM_BUTTONS - 1) % NUM_BUTTONS;
+        if(prev < NUM_BUTTONS && prev != (unsigned)i)
+            coupled += mux[i] * in[prev];
+
+        int32_t const force = in[i] - ((coupled + 128) >> 8);
+        readings[i] = force < 0 ? 0 : force > 255 ? 255 : force;
+    }
+}
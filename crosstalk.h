@@ -0,0 +1,22 @@
+#ifndef CROSSTALK_H_
+#define CROSSTALK_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+
+// Crosstalk correction. A hard press on one panel lifts the readings of
+// others: the next channel through the ADC mux, and neighbouring panels
+// through the frame flexing. Both are close to linear in force, so each
+// reading has a calibrated share of the others subtracted.
+
+// Rebuilds the correction matrix from config.crosstalk.
+void crosstalk_update(void);
+
+// Corrects one pass of readings, in place. 'before' names the channel
+// converted just ahead of each reading, which the mux term follows; one
+// that follows itself or something other than a panel gets none. NULL
+// means the fixed order, each channel after the one numbered before it.
+void crosstalk_apply(force_t* readings, uint8_t const* before);
+
+#endif /* CROSSTALK_H_ */
@@ -0,0 +1,24 @@
+#include "curve.h"
+#include "config.h"
+
+force_t force_lut[NUM_BUTTONS][256];
+
+// Interpolates linearly between the knots.
+static void build(uint8_t const knots[CURVE_KNOTS], force_t lut[256])
+{
+    for(int k = 0; k < CURVE_KNOTS - 1; ++k)
+    {
+        int const x0 = k * CURVE_STEP;
+        int const x1 = (k == CURVE_KNOTS - 2) ? 255 : x0 + CURVE_STEP;
+        int const dy = knots[k + 1] - knots[k];
+
+        for(int x = x0; x <= x1; ++x)
+            lut[x] = knots[k] + (dy * (x - x0) + (dy < 0 ? -1 : 1) * (x1 - x0) / 2) / (x1 - x0);
+    }
+}
+
+void curve_update(void)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        build(config.curves[i], force_lut[i]);
+}
@@ -0,0 +1,18 @@
+#ifndef CURVE_H_
+#define CURVE_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+
+// Force linearization. FSR readings are far from linear in force, so each
+// sensor's reading goes through a lookup table built from the force curve
+// in the config. Thresholds then compare against near-linear force.
+
+// Indexed by the inverted 8-bit ADC code.
+extern force_t force_lut[NUM_BUTTONS][256];
+
+// Rebuilds the lookup tables from config.curves.
+void curve_update(void);
+
+#endif /* CURVE_H_ */
@@ -0,0 +1,20 @@
+#include "cycles.h"
+
+static uint32_t saved_csr = 0;
+static uint32_t saved_rvr = 0;
+
+void cycles_start(void)
+{
+    saved_csr = systick_hw->csr;
+    saved_rvr = systick_hw->rvr;
+
+    systick_hw->rvr = M0PLUS_SYST_RVR_BITS;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_ENABLE_BITS | M0PLUS_SYST_CSR_CLKSOURCE_BITS;
+}
+
+void cycles_stop(void)
+{
+    systick_hw->rvr = saved_rvr;
+    systick_hw->csr = saved_csr;
+}
@@ -0,0 +1,27 @@
+#ifndef CYCLES_H_
+#define CYCLES_H_
+
+#include <stdint.h>
+
+#include "hardware/structs/systick.h"
+
+// Cycle counts from SysTick, for the timings taken at mount.
+// cycles_start() runs SysTick free on the core clock until cycles_stop()
+// puts back what it was doing. Spans must stay under 2^24 cycles.
+
+void cycles_start(void);
+void cycles_stop(void);
+
+static inline uint32_t cycles_now(void)
+{
+    return systick_hw->cvr;
+}
+
+// Cycles since 'start', a cycles_now() reading.
+static inline uint32_t cycles_since(uint32_t start)
+{
+    // SysTick counts down.
+    return (start - systick_hw->cvr) & M0PLUS_SYST_RVR_BITS;
+}
+
+#endif /* CYCLES_H_ */
@@ -0,0 +1,46 @@
+#include "debounce.h"
+
+buttons_t debounce(debounce_t* db, buttons_t raw, buttons_t held, debounce_config_t const* cfg)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        buttons_t const button = 1 << i;
+        if(held & button)
+            continue;
+
+        bool const in = raw & button;
+        bool const out = db->buttons & button;
+
+        if(in == out)
+            db->run[i] = 0;
+        else if(db->run[i] < 0xFF)
+            ++db->run[i];
+
+        if(db->hold[i])
+        {
+            --db->hold[i];
+            continue;
+        }
+
+        if(in == out)
+            continue;
+
+        if(out)
+        {
+            if(cfg->flags & DEBOUNCE_DEFER_RELEASE)
+            {
+                if(db->run[i] < cfg->min_release)
+                    continue;
+            }
+            else
+                db->hold[i] = cfg->min_release;
+        }
+        else
+            db->hold[i] = cfg->min_press;
+
+        db->buttons ^= button;
+        db->run[i] = 0;
+    }
+
+    return db->buttons;
+}
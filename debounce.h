@@ -0,0 +1,42 @@
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pad.h"
+
+// Per-button anti-chatter state machine, stepped on each sample of a
+// button's channel: every pass, or every slot that converts it with the
+// adaptive schedule.
+//
+// Edges pass through on the sample they occur, so a real press is never
+// delayed. After a press, the button holds for at least min_press samples.
+// After a release, it stays released for at least min_release samples.
+// With DEBOUNCE_DEFER_RELEASE, a release is instead only accepted once the
+// input has stayed released for min_release samples, and a new press may
+// follow immediately.
+
+enum
+{
+    DEBOUNCE_DEFER_RELEASE = 1 << 0,
+};
+
+typedef struct
+{
+    uint8_t min_press;   // In samples, 0 to disable.
+    uint8_t min_release; // In samples, 0 to disable.
+    uint8_t flags;       // DEBOUNCE_* bits
+} debounce_config_t;
+
+typedef struct
+{
+    buttons_t buttons;         // Debounced state.
+    uint8_t hold[NUM_BUTTONS]; // Samples left before the button may change.
+    uint8_t run[NUM_BUTTONS];  // Consecutive samples the input has disagreed.
+} debounce_t;
+
+// Buttons in 'held' have no new sample, and keep their state and counts.
+buttons_t debounce(debounce_t* db, buttons_t raw, buttons_t held, debounce_config_t const* cfg);
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,63 @@
+#include "edge_queue.h"
+
+// State of the newest entry. Only the producer writes entries, so the
+// slot stays valid after the consumer takes it.
+static buttons_t newest(edge_queue_t const* q)
+{
+    return q->edges[(uint8_t)(q->head - 1) % EDGE_QUEUE_SIZE].buttons;
+}
+
+void edge_queue_coalesce(edge_queue_t* q, buttons_t buttons, uint32_t time_us)
+{
+    if(!q->coalescing)
+    {
+        q->coalescing = true;
+        q->state = newest(q);
+        q->pressed = 0;
+        q->released = 0;
+        q->first_us = time_us;
+        if(q->overflows)
+            ++*q->overflows;
+    }
+
+    q->pressed |= buttons & ~q->state;
+    q->released |= q->state & ~buttons;
+    q->state = buttons;
+    q->last_us = time_us;
+    if(q->coalesced)
+        ++*q->coalesced;
+
+    edge_queue_replay(q);
+}
+
+// Replays the coalesced edges as up to three states: every button that
+// moved flips, the ones that moved both ways flip back, then the latest
+// state. Waits until all of them fit, so they go out together.
+void edge_queue_replay(edge_queue_t* q)
+{
+    buttons_t const from = newest(q);
+    buttons_t const moved = (~from & q->pressed) | (from & q->released);
+    buttons_t const flipped = from ^ moved;
+    buttons_t const states[3] = { flipped, flipped ^ (moved & q->pressed & q->released), q->state };
+    uint32_t const times[3] = { q->first_us, q->first_us, q->last_us };
+
+    int count = 0;
+    buttons_t prev = from;
+    for(int i = 0; i < 3; ++i)
+    {
+        count += states[i] != prev;
+        prev = states[i];
+    }
+
+    if(EDGE_QUEUE_SIZE - (uint8_t)(q->head - q->tail) < count)
+        return;
+
+    q->coalescing = false;
+    prev = from;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(states[i] != prev)
+            edge_queue_push(q, states[i], times[i]);
+        prev = states[i];
+    }
+}
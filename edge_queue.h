@@ -0,0 +1,91 @@
+#ifndef EDGE_QUEUE_H_
+#define EDGE_QUEUE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pad.h"
+
+// Lock-free single-producer, single-consumer queue of button edges.
+// The producer only writes head and the consumer only writes tail, so
+// either side can run from an interrupt on the same core without locks.
+//
+// Each entry carries the whole debounced state. Edges that arrive while
+// the queue is full are coalesced by the producer and replayed once
+// there's room, such that every button that went down is seen down and
+// every button that went up is seen up; only repeats collapse.
+
+#define EDGE_QUEUE_SIZE 16 // Power of two.
+
+typedef struct
+{
+    uint32_t time_us; // Sample the edge was decided on.
+    buttons_t buttons; // Debounced state after the edge.
+} edge_t;
+
+typedef struct
+{
+    edge_t edges[EDGE_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+
+    // Producer only.
+    bool coalescing;
+    buttons_t state;    // Latest coalesced state.
+    buttons_t pressed;  // Buttons that went down while coalescing.
+    buttons_t released; // Buttons that went up while coalescing.
+    uint32_t first_us;  // First and latest coalesced edges.
+    uint32_t last_us;
+    uint32_t* overflows; // Counted here if set: times the queue filled up,
+    uint32_t* coalesced; // and edges that didn't get an entry of their own.
+} edge_queue_t;
+
+void edge_queue_coalesce(edge_queue_t* q, buttons_t buttons, uint32_t time_us);
+void edge_queue_replay(edge_queue_t* q);
+
+static inline void edge_queue_push(edge_queue_t* q, buttons_t buttons, uint32_t time_us)
+{
+    uint8_t const head = q->head;
+    if(q->coalescing || (uint8_t)(head - q->tail) == EDGE_QUEUE_SIZE)
+    {
+        edge_queue_coalesce(q, buttons, time_us);
+        return;
+    }
+    q->edges[head % EDGE_QUEUE_SIZE] = (edge_t){ time_us, buttons };
+    atomic_signal_fence(memory_order_release);
+    q->head = head + 1;
+}
+
+// Called by the producer on passes without an edge, so coalesced edges
+// go out as soon as the consumer makes room.
+static inline void edge_queue_flush(edge_queue_t* q)
+{
+    if(q->coalescing)
+        edge_queue_replay(q);
+}
+
+// Consumer: looks at the oldest entry without taking it.
+static inline bool edge_queue_peek(edge_queue_t const* q, edge_t* edge)
+{
+    uint8_t const tail = q->tail;
+    if(tail == q->head)
+        return false;
+    atomic_signal_fence(memory_order_acquire);
+    *edge = q->edges[tail % EDGE_QUEUE_SIZE];
+    return true;
+}
+
+static inline bool edge_queue_pop(edge_queue_t* q, edge_t* edge)
+{
+    uint8_t const tail = q->tail;
+    if(tail == q->head)
+        return false;
+    atomic_signal_fence(memory_order_acquire);
+    *edge = q->edges[tail % EDGE_QUEUE_SIZE];
+    atomic_signal_fence(memory_order_release);
+    q->tail = tail + 1;
+    return true;
+}
+
+#endif /* EDGE_QUEUE_H_ */
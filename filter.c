@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "filter.h"
+
+//--------------------------------------------------------------------+
+// Reference implementation
+//--------------------------------------------------------------------+
+
+void filter_sensors_scalar(force_t* sensors, force_t const* readings)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        sensors[i] = ((sensors[i] * 3) + readings[i]) / 4;
+}
+
+buttons_t filter_buttons_scalar(force_t const* sensors, force_t const* thresholds, buttons_t buttons)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        buttons_t const button = 1 << i;
+
+        if(sensors[i] < thresholds[i] - SENSOR_PADDING)
+            buttons &= ~button;
+        else if(sensors[i] >= thresholds[i] + SENSOR_PADDING)
+            buttons |= button;
+    }
+
+    return buttons;
+}
+
+//--------------------------------------------------------------------+
+// Packed lanes
+//--------------------------------------------------------------------+
+
+// Lane i of a word is sensor i, which relies on a little-endian core.
+#define LANES 4
+#define WORDS ((NUM_BUTTONS + LANES - 1) / LANES)
+#define LANE_LSB 0x01010101u
+#define LANE_MSB 0x80808080u
+#define EVEN_LANES 0x00FF00FFu
+
+static inline unsigned lanes_in(int w)
+{
+    return (NUM_BUTTONS - w * LANES) < LANES ? (NUM_BUTTONS - w * LANES) : LANES;
+}
+
+// Unused lanes of the last word read as 0.
+static inline uint32_t load(force_t const* array, int w)
+{
+    uint32_t word = 0;
+    memcpy(&word, array + w * LANES, lanes_in(w));
+    return word;
+}
+
+static inline void store(force_t* array, int w, uint32_t word)
+{
+    memcpy(array + w * LANES, &word, lanes_in(w));
+}
+
+// Lane-wise x + y and x - y, wrapping within each lane.
+static inline uint32_t add_lanes(uint32_t x, uint32_t y)
+{
+    return ((x & ~LANE_MSB) + (y & ~LANE_MSB)) ^ ((x ^ y) & LANE_MSB);
+}
+
+static inline uint32_t sub_lanes(uint32_t x, uint32_t y)
+{
+    return ((x | LANE_MSB) - (y & ~LANE_MSB)) ^ ((x ^ ~y) & LANE_MSB);
+}
+
+// Lane-wise unsigned x >= y, as the top bit of each lane.
+static inline uint32_t ge_lanes(uint32_t x, uint32_t y)
+{
+    uint32_t const low = (x | LANE_MSB) - (y & ~LANE_MSB); // Compares the low 7 bits.
+    return ((x & ~y) | (~(x ^ y) & low)) & LANE_MSB;
+}
+
+void filter_sensors_swar(force_t* sensors, force_t const* readings)
+{
+    // 3s + n needs 10 bits, so blend the even and odd lanes
+    // separately as two 16-bit lanes each.
+    for(int w = 0; w < WORDS; ++w)
+    {
+        uint32_t const s = load(sensors, w);
+        uint32_t const n = load(readings, w);
+        uint32_t const even = ((s & EVEN_LANES) * 3 + (n & EVEN_LANES)) >> 2;
+        uint32_t const odd = (((s >> 8) & EVEN_LANES) * 3 + ((n >> 8) & EVEN_LANES)) >> 2;
+        store(sensors, w, (even & EVEN_LANES) | ((odd & EVEN_LANES) << 8));
+    }
+}
+
+buttons_t filter_buttons_swar(force_t const* sensors, force_t const* thresholds, buttons_t buttons)
+{
+    uint32_t const padding = SENSOR_PADDING * LANE_LSB;
+    buttons_t result = 0;
+
+    _Static_assert(SENSOR_PADDING < 0x80, "Padding must fit in 7 bits");
+
+    for(int w = 0; w < WORDS; ++w)
+    {
+        uint32_t const s = load(sensors, w);
+        uint32_t const t = load(thresholds, w);
+
+        // Where threshold +/- padding would wrap, the scalar comparison
+        // can never be true, so those lanes are masked out.
+        uint32_t const high = add_lanes(t, padding);
+        uint32_t const low = sub_lanes(t, padding);
+        uint32_t const high_wrapped = t & ~high & LANE_MSB;
+        uint32_t const low_wrapped = ~t & low & LANE_MSB;
+
+        uint32_t const press = ge_lanes(s, high) & ~high_wrapped;
+        uint32_t const release = ~ge_lanes(s, low) & ~low_wrapped & LANE_MSB;
+
+        // Spread the previous button bits to the top bit of each lane,
+        // update them, and gather them back.
+        uint32_t const prev_bits = (buttons >> (w * LANES)) & 0xF;
+        uint32_t const prev = ((prev_bits * 0x00204081u) & LANE_LSB) << 7;
+        uint32_t const state = (prev & ~release) | press;
+
+        result |= (((state >> 7) * 0x01020408u) >> 24 & 0xF) << (w * LANES);
+    }
+
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "pad.h"
+
+// Sensor filter and threshold decision, run on every sample pass.
+//
+// The default implementation packs four 8-bit sensor lanes into each
+// 32-bit word and processes them without branches. Building with
+// PAD_FILTER_SCALAR selects the per-sensor reference implementation,
+// and PAD_FILTER_INTERP runs the blend on the RP2040 interpolator.
+// All of them give identical results.
+
+// Hysteresis around each threshold.
+#define SENSOR_PADDING 2
+
+// Blends new readings into the filtered values: s = (3s + n) / 4.
+void filter_sensors_scalar(force_t* sensors, force_t const* readings);
+void filter_sensors_swar(force_t* sensors, force_t const* readings);
+void filter_sensors_interp(force_t* sensors, force_t const* readings);
+
+// Presses a button at threshold + SENSOR_PADDING and releases it below
+// threshold - SENSOR_PADDING. Returns the new undebounced buttons.
+buttons_t filter_buttons_scalar(force_t const* sensors, force_t const* thresholds, buttons_t buttons);
+buttons_t filter_buttons_swar(force_t const* sensors, force_t const* thresholds, buttons_t buttons);
+
+// Sets up interp0 for filter_sensors_interp(). The interpolator is
+// per core, so this runs on the core that samples.
+void filter_interp_init(void);
+
+// Times a pass of each implementation with SysTick, into stats.
+void filter_benchmark(void);
+
+#if defined(PAD_FILTER_SCALAR)
+#define filter_sensors filter_sensors_scalar
+#define filter_buttons filter_buttons_scalar
+#define filter_init() ((void)0)
+#elif defined(PAD_FILTER_INTERP)
+#define filter_sensors filter_sensors_interp
+#define filter_buttons filter_buttons_swar
+#define filter_init filter_interp_init
+#else
+#define filter_sensors filter_sensors_swar
+#define filter_buttons filter_buttons_swar
+#define filter_init() ((void)0)
+#endif
+
+#endif /* FILTER_H_ */
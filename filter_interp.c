@@ -0,0 +1,72 @@
+#include "pico/stdlib.h"
+#include "hardware/interp.h"
+
+#include "filter.h"
+#include "stats.h"
+#include "cycles.h"
+
+// interp0 lane 1 blends BASE0 towards BASE1 by ACCUM1 / 256. With signed
+// lanes that is s + floor((n - s) / 4), which is exactly (3s + n) / 4.
+#define ALPHA (256 / 4)
+
+#define BENCHMARK_PASSES 64
+
+void filter_interp_init(void)
+{
+    interp_config cfg = interp_default_config();
+    interp_config_set_blend(&cfg, true);
+    interp_set_config(interp0, 0, &cfg);
+
+    cfg = interp_default_config();
+    interp_config_set_signed(&cfg, true);
+    interp_set_config(interp0, 1, &cfg);
+
+    interp0->accum[1] = ALPHA;
+}
+
+void filter_sensors_interp(force_t* sensors, force_t const* readings)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        interp0->base[0] = sensors[i];
+        interp0->base[1] = readings[i];
+        sensors[i] = interp0->peek[1];
+    }
+}
+
+typedef void (*filter_sensors_fn)(force_t*, force_t const*);
+typedef buttons_t (*filter_buttons_fn)(force_t const*, force_t const*, buttons_t);
+
+// Returns the average cycles of a filter pass.
+static uint32_t time_pass(filter_sensors_fn sensors_fn, filter_buttons_fn buttons_fn)
+{
+    force_t sensors[NUM_BUTTONS] = {};
+    force_t readings[NUM_BUTTONS];
+    force_t thresholds[NUM_BUTTONS];
+    buttons_t buttons = 0;
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        readings[i] = 200 + i;
+        thresholds[i] = 100 + i;
+    }
+
+    uint32_t const start = cycles_now();
+    for(int pass = 0; pass < BENCHMARK_PASSES; ++pass)
+    {
+        sensors_fn(sensors, readings);
+        buttons = buttons_fn(sensors, thresholds, buttons);
+        readings[pass % NUM_BUTTONS] ^= 0xFF; // Keep edges coming.
+    }
+    return cycles_since(start) / BENCHMARK_PASSES;
+}
+
+void filter_benchmark(void)
+{
+    cycles_start();
+    filter_interp_init();
+    stats.filter_scalar_cycles = time_pass(filter_sensors_scalar, filter_buttons_scalar);
+    stats.filter_swar_cycles = time_pass(filter_sensors_swar, filter_buttons_swar);
+    stats.filter_interp_cycles = time_pass(filter_sensors_interp, filter_buttons_swar);
+    cycles_stop();
+}
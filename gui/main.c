@@ -2,6 +2,7 @@
 
 // STD
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,6 +12,21 @@
 // libusb
 #include <hidapi.h>
 
+#include "protocol.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define sleep_ms(ms) Sleep(ms)
+#else
+#include <unistd.h>
+#define sleep_ms(ms) usleep((ms) * 1000)
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <libudev.h>
+#endif
+
 // Curses (put last)
 #ifdef _WIN32
 #define PDC_WIDE
@@ -23,6 +39,8 @@ enum
 {
   REPORT_ID_BUTTONS = 1,
   REPORT_ID_FEATURES,
+  REPORT_ID_KEYBOARD,
+  REPORT_ID_COMMAND,
   REPORT_ID_COUNT
 };
 
@@ -33,73 +51,487 @@ enum
     CP_BAR_POST,
 };
 
-struct hid_device_info* enumeration = NULL;
-struct hid_device_info* entry = NULL;
 hid_device* device = NULL;
 
-uint8_t sensors[4] = {};
-uint8_t thresholds[4] = {};
+// The firmware's limit, one ADC input per button. Per-button fields are
+// num_buttons long on the wire, as FIELD_INFO says.
+#define MAX_BUTTONS 4
+
+int num_buttons = MAX_BUTTONS;
+uint8_t sensors[MAX_BUTTONS] = {};
+uint8_t thresholds[MAX_BUTTONS] = {};
+uint8_t keys[MAX_BUTTONS] = {};
+uint8_t report_mode = 0;
+uint8_t curves[MAX_BUTTONS][CURVE_KNOTS] = {}; // All zero if the firmware has no curves.
+int link_role = -1; // -1 if the firmware has no pad link.
 int ui_line = 0;
 
 static char io_buf[64] = {};
 static char device_name[64] = {};
 
+// Command protocol batch, with the report ID in front.
+static uint8_t batch[1 + COMMAND_REPORT_SIZE];
+static unsigned batch_size = 0;
+static bool polling = false; // Whether the device holds the sensor polling batch.
+
+void batch_begin(void)
+{
+    memset(batch, 0, sizeof(batch));
+    batch[0] = REPORT_ID_COMMAND; // Report number
+    batch[1] = COMMAND_VERSION;
+    batch_size = 1 + sizeof(struct command_header);
+}
+
+void batch_op(uint8_t op, uint8_t arg, void const* data, uint8_t len)
+{
+    batch[batch_size++] = op;
+    batch[batch_size++] = arg;
+    batch[batch_size++] = len;
+    if(len)
+        memcpy(batch + batch_size, data, len);
+    batch_size += len;
+    ++batch[2];
+}
+
+bool batch_send(void)
+{
+    polling = false;
+    return device && hid_send_feature_report(device, batch, sizeof(batch)) >= 0;
+}
+
+// Fetches the results of the last batch into io_buf.
+bool batch_fetch(void)
+{
+    io_buf[0] = REPORT_ID_COMMAND; // Report number
+    return device && hid_get_feature_report(device, (unsigned char*)io_buf, sizeof(io_buf)) > 0;
+}
+
+// Returns the data of result 'index', or NULL if the operation failed.
+uint8_t const* batch_result(int index, int* len)
+{
+    uint8_t const* result = (uint8_t const*)io_buf + 1 + sizeof(struct command_header);
+    uint8_t const* const end = (uint8_t const*)io_buf + sizeof(io_buf);
+
+    for(int i = 0; i < io_buf[2] && result + 3 <= end; ++i)
+    {
+        if(i == index)
+        {
+            if(result[1] != STATUS_OK || result + 3 + result[2] > end)
+                return NULL;
+            *len = result[2];
+            return result + 3;
+        }
+        result += 3 + result[2];
+    }
+
+    return NULL;
+}
+
 void read_sensors(void)
 {
     if(!device)
         return;
-    io_buf[0] = REPORT_ID_FEATURES; // Report number
-    if(hid_get_feature_report(device, io_buf, sizeof(io_buf)))
-        memcpy(sensors, io_buf+5, sizeof(sensors));
+
+    // The polling batch stays on the device, so each poll is one transfer.
+    if(!polling)
+    {
+        batch_begin();
+        batch_op(OP_GET, FIELD_SENSORS, NULL, 0);
+        if(!batch_send())
+            return;
+        polling = true;
+    }
+
+    int len;
+    uint8_t const* data;
+    if(batch_fetch() && (data = batch_result(0, &len)) && len >= num_buttons)
+        memcpy(sensors, data, num_buttons);
 }
 
-void read_thresholds(void)
+// The button count sizes every per-button field, so it's read first.
+// Without an answer, the pad is taken to have MAX_BUTTONS.
+static bool read_info(void)
 {
-    if(!device)
+    num_buttons = MAX_BUTTONS;
+    batch_begin();
+    batch_op(OP_GET, FIELD_INFO, NULL, 0);
+    if(!batch_send() || !batch_fetch())
+        return false;
+
+    int len;
+    uint8_t const* const data = batch_result(0, &len);
+    if(data && len >= (int)sizeof(struct pad_info))
+    {
+        struct pad_info info;
+        memcpy(&info, data, sizeof(info));
+        if(info.num_buttons >= 1 && info.num_buttons <= MAX_BUTTONS)
+            num_buttons = info.num_buttons;
+    }
+    if(ui_line >= num_buttons)
+        ui_line = 0;
+    return true;
+}
+
+void read_config(void)
+{
+    if(!device || !read_info())
         return;
-    io_buf[0] = REPORT_ID_FEATURES; // Report number
-    if(hid_get_feature_report(device, io_buf, sizeof(io_buf)))
-        memcpy(thresholds, io_buf+1, sizeof(thresholds));
+
+    batch_begin();
+    batch_op(OP_GET, FIELD_THRESHOLDS, NULL, 0);
+    batch_op(OP_GET, FIELD_KEYS, NULL, 0);
+    batch_op(OP_GET, FIELD_REPORT_MODE, NULL, 0);
+    batch_op(OP_GET, FIELD_CURVES, NULL, 0);
+    batch_op(OP_GET, FIELD_LINK_ROLE, NULL, 0);
+    if(!batch_send() || !batch_fetch())
+        return;
+
+    int len;
+    uint8_t const* data;
+    if((data = batch_result(0, &len)) && len >= num_buttons)
+        memcpy(thresholds, data, num_buttons);
+    if((data = batch_result(1, &len)) && len >= num_buttons)
+        memcpy(keys, data, num_buttons);
+    if((data = batch_result(2, &len)) && len >= 1)
+        report_mode = data[0];
+    if((data = batch_result(3, &len)) && len >= num_buttons * CURVE_KNOTS)
+        memcpy(curves, data, num_buttons * CURVE_KNOTS);
+    link_role = ((data = batch_result(4, &len)) && len >= 1) ? data[0] : -1;
 }
 
-void write_thresholds(void)
+// Writes and commits everything in one transfer.
+// The pad only touches flash if something changed.
+void write_config(void)
 {
     if(!device)
         return;
-    io_buf[0] = REPORT_ID_FEATURES; // Report number
-    memcpy(io_buf+1, thresholds, sizeof(thresholds));
-    hid_send_feature_report(device, io_buf, sizeof(thresholds) + 1);
+
+    batch_begin();
+    batch_op(OP_SET, FIELD_THRESHOLDS, thresholds, num_buttons);
+    batch_op(OP_SET, FIELD_KEYS, keys, num_buttons);
+    if(report_mode)
+        batch_op(OP_SET, FIELD_REPORT_MODE, &report_mode, 1);
+    if(curves[0][CURVE_KNOTS-1])
+        batch_op(OP_SET, FIELD_CURVES, curves, num_buttons * CURVE_KNOTS);
+    batch_op(OP_COMMIT, 0, NULL, 0);
+    batch_send();
 }
 
-void enumerate(void)
+void write_curves(void)
 {
-    if(enumeration)
-        hid_free_enumeration(enumeration);
-    enumeration = entry = hid_enumerate(0x16C0, 0x27D9);
+    batch_begin();
+    batch_op(OP_SET, FIELD_CURVES, curves, num_buttons * CURVE_KNOTS);
+    batch_send();
 }
 
-void find_next_entry(void)
+// Fits a button's force curve to readings taken under known loads.
+// The readings are taken through a linear curve, so they're raw codes.
+#define CAL_LOADS 5 // None, 1/4, 1/2, 3/4 and full load.
+void calibrate_curve(int button)
 {
-    bool retried = false;
-    while(entry)
+    uint8_t const* const knots = curves[button];
+    uint8_t old[CURVE_KNOTS];
+    uint8_t codes[CAL_LOADS];
+    int const y = getcury(stdscr);
+
+    if(!device || !knots[CURVE_KNOTS-1])
+        return;
+
+    memcpy(old, knots, sizeof(old));
+    for(int k = 0; k < CURVE_KNOTS; ++k)
+        curves[button][k] = k < CURVE_KNOTS - 1 ? k * CURVE_STEP : 255;
+    write_curves();
+
+    for(int j = 0; j < CAL_LOADS; ++j)
     {
-        if(!(entry = entry->next))
+        move(y, 0);
+        clrtoeol();
+        printw("Put %i/4 of full load on button %i and press Enter: ", j, button);
+        getnstr(io_buf, sizeof(io_buf));
+
+        // Average out sensor noise.
+        unsigned sum = 0;
+        for(int n = 0; n < 16; ++n)
         {
-            if(retried)
-                return;
-            enumerate();
-            retried = true;
+            read_sensors();
+            sum += sensors[button];
         }
-        else if(entry->usage == 0xA0 && wcscmp(entry->manufacturer_string, L"http://pubby.games") == 0)
+        codes[j] = sum / 16;
+
+        if(j > 0 && codes[j] <= codes[j-1])
         {
-            if(device)
-                hid_close(device);
-            device = hid_open_path(entry->path);
-            strncpy(device_name, entry->path, sizeof(device_name));
-            device_name[sizeof(device_name)-1] = '\0';
+            move(y, 0);
+            clrtoeol();
+            printw("Readings must rise with load. Calibration cancelled.");
+            memcpy(curves[button], old, sizeof(old));
+            write_curves();
+            getch();
             return;
         }
     }
+
+    // Knot force is the load fraction at the knot's code, scaled to 255.
+    for(int k = 0; k < CURVE_KNOTS; ++k)
+    {
+        int const x = k < CURVE_KNOTS - 1 ? k * CURVE_STEP : 255;
+        int j = 0;
+        while(j < CAL_LOADS - 2 && x >= codes[j+1])
+            ++j;
+
+        int force = (j * (codes[j+1] - codes[j]) + (x - codes[j])) * 255
+                  / ((CAL_LOADS - 1) * (codes[j+1] - codes[j]));
+        if(force < 0)
+            force = 0;
+        else if(force > 255)
+            force = 255;
+        curves[button][k] = force;
+    }
+    write_curves();
+
+    move(y, 0);
+    clrtoeol();
+    printw("Calibrated. Thresholds are now in force units; retune them.");
+    getch();
+}
+
+// Takes effect at once; saved with the rest of the config.
+void write_link_role(void)
+{
+    uint8_t const role = link_role;
+    batch_begin();
+    batch_op(OP_SET, FIELD_LINK_ROLE, &role, 1);
+    batch_send();
+}
+
+char const* link_role_name(void)
+{
+    switch(link_role)
+    {
+    case LINK_OFF: return "Off";
+    case LINK_PRIMARY: return "Primary";
+    case LINK_SECONDARY: return "Secondary";
+    default: return "?";
+    }
+}
+
+char const* report_mode_name(void)
+{
+    switch(report_mode & (REPORT_MODE_GAMEPAD | REPORT_MODE_KEYBOARD))
+    {
+    case 1: return "Gamepad";
+    case 2: return "Keyboard";
+    case 3: return "Gamepad+Keyboard";
+    default: return "?";
+    }
+}
+
+//--------------------------------------------------------------------+
+// Device table
+//--------------------------------------------------------------------+
+
+// Pads found so far. On Linux a udev monitor adds and removes them as
+// they come and go; elsewhere the table is rebuilt when Tab wraps around.
+// The open pad is remembered by serial number, so that it's reopened
+// when it comes back, e.g. after a USB reset.
+
+#define MAX_PADS 64
+
+typedef struct
+{
+    char path[256];
+    wchar_t serial[64];
+} pad_entry_t;
+
+static pad_entry_t pads[MAX_PADS];
+static int num_pads = 0;
+static int current_pad = -1; // Index of the open pad, or -1.
+static wchar_t current_serial[64] = {}; // Of the last pad opened, kept while it's gone.
+
+static bool is_pubby_pad(struct hid_device_info const* d)
+{
+    return d->usage == 0xA0 && d->manufacturer_string
+        && wcscmp(d->manufacturer_string, L"http://pubby.games") == 0;
+}
+
+static int find_pad(char const* path)
+{
+    for(int i = 0; i < num_pads; ++i)
+        if(strcmp(pads[i].path, path) == 0)
+            return i;
+    return -1;
+}
+
+static void add_pad(char const* path, wchar_t const* serial)
+{
+    if(find_pad(path) >= 0 || num_pads == MAX_PADS)
+        return;
+
+    pad_entry_t* const pad = &pads[num_pads++];
+    snprintf(pad->path, sizeof(pad->path), "%s", path);
+    swprintf(pad->serial, sizeof(pad->serial) / sizeof(wchar_t), L"%ls", serial ? serial : L"");
+}
+
+static void close_pad(void)
+{
+    if(device)
+        hid_close(device);
+    device = NULL;
+    current_pad = -1;
+    polling = false;
+}
+
+static void remove_pad(char const* path)
+{
+    int const i = find_pad(path);
+    if(i < 0)
+        return;
+
+    if(i == current_pad)
+        close_pad();
+    else if(i < current_pad)
+        --current_pad;
+    memmove(&pads[i], &pads[i + 1], (num_pads - i - 1) * sizeof(*pads));
+    --num_pads;
+}
+
+static void open_pad(int i)
+{
+    close_pad();
+    device = hid_open_path(pads[i].path);
+    current_pad = i;
+    wcscpy(current_serial, pads[i].serial);
+    strncpy(device_name, pads[i].path, sizeof(device_name));
+    device_name[sizeof(device_name)-1] = '\0';
+}
+
+// Adds every pad present now.
+void enumerate(void)
+{
+    struct hid_device_info* const devices = hid_enumerate(0x16C0, 0x27D9);
+    for(struct hid_device_info const* d = devices; d; d = d->next)
+        if(is_pubby_pad(d))
+            add_pad(d->path, d->serial_number);
+    hid_free_enumeration(devices);
+}
+
+// With no pad open, opens the one that was open last if it's back,
+// or the first pad found if none was opened yet.
+void reconnect(void)
+{
+    if(current_pad >= 0)
+        return;
+
+    for(int i = 0; i < num_pads; ++i)
+    {
+        if(!current_serial[0] || wcscmp(pads[i].serial, current_serial) == 0)
+        {
+            open_pad(i);
+            read_config();
+            return;
+        }
+    }
+}
+
+#ifdef __linux__
+static struct udev* udev = NULL;
+static struct udev_monitor* monitor = NULL;
+
+// Started before the first enumeration, so no pad slips in between.
+static void monitor_init(void)
+{
+    if(!(udev = udev_new()))
+        return;
+    if(!(monitor = udev_monitor_new_from_netlink(udev, "udev")))
+        return;
+    udev_monitor_filter_add_match_subsystem_devtype(monitor, "hidraw", NULL);
+    udev_monitor_enable_receiving(monitor);
+}
+
+// The checks is_pubby_pad() makes, from udev. The pad has a single HID
+// interface, so its vendor usage needn't be looked up.
+static bool udev_is_pad(struct udev_device* dev, wchar_t* serial, size_t size)
+{
+    struct udev_device* const hid = udev_device_get_parent_with_subsystem_devtype(dev, "hid", NULL);
+    struct udev_device* const usb = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+    if(!hid || !usb)
+        return false;
+
+    // Bus, vendor and product, e.g. "0003:000016C0:000027D9".
+    char const* const id = udev_device_get_property_value(hid, "HID_ID");
+    unsigned bus, vid, pid;
+    if(!id || sscanf(id, "%x:%x:%x", &bus, &vid, &pid) != 3 || vid != 0x16C0 || pid != 0x27D9)
+        return false;
+
+    char const* const manufacturer = udev_device_get_sysattr_value(usb, "manufacturer");
+    if(!manufacturer || strcmp(manufacturer, "http://pubby.games") != 0)
+        return false;
+
+    char const* const uniq = udev_device_get_property_value(hid, "HID_UNIQ");
+    swprintf(serial, size, L"%s", uniq ? uniq : "");
+    return true;
+}
+
+// Applies pending hotplug events without blocking.
+static void monitor_poll(void)
+{
+    if(!monitor)
+        return;
+
+    struct pollfd fd = { udev_monitor_get_fd(monitor), POLLIN, 0 };
+    struct udev_device* dev;
+    while(poll(&fd, 1, 0) > 0 && (dev = udev_monitor_receive_device(monitor)))
+    {
+        char const* const action = udev_device_get_action(dev);
+        char const* const node = udev_device_get_devnode(dev);
+        wchar_t serial[64];
+        if(action && node && strcmp(action, "remove") == 0)
+            remove_pad(node);
+        else if(action && node && strcmp(action, "add") == 0 && udev_is_pad(dev, serial, 64))
+            add_pad(node, serial);
+        udev_device_unref(dev);
+    }
+
+    reconnect();
+}
+
+static void monitor_exit(void)
+{
+    if(monitor)
+        udev_monitor_unref(monitor);
+    if(udev)
+        udev_unref(udev);
+}
+#else
+// Pads are picked up when Tab wraps around instead.
+static void monitor_init(void) {}
+static void monitor_poll(void) {}
+static void monitor_exit(void) {}
+
+// Rebuilds the table, keeping the open pad if it's still there.
+static void rescan(void)
+{
+    char path[256] = "";
+    if(current_pad >= 0)
+        snprintf(path, sizeof(path), "%s", pads[current_pad].path);
+
+    num_pads = 0;
+    enumerate();
+
+    current_pad = find_pad(path);
+    if(current_pad < 0)
+        close_pad();
+}
+#endif
+
+// Opens the next pad, wrapping around.
+void next_pad(void)
+{
+#ifndef __linux__
+    if(current_pad + 1 >= num_pads)
+        rescan();
+#endif
+    if(num_pads)
+        open_pad((current_pad + 1) % num_pads);
 }
 
 void poll_mode(bool on)
@@ -120,8 +552,618 @@ void poll_mode(bool on)
     }
 }
 
-int main(void)
+//--------------------------------------------------------------------+
+// Headless mode
+//--------------------------------------------------------------------+
+
+// For scripting across many pads. Pads are enumerated once and stay open,
+// and every command runs in order against each of them. Output is a JSON
+// object per pad and command, or CSV with a header whenever the columns
+// change. Errors go to stderr.
+
+#define CLI_MAX_PADS 256
+#define CLI_MAX_TOKENS 32
+
+typedef struct
+{
+    hid_device* handle;
+    char path[256];
+    char serial[64];
+    int num_buttons;
+} cli_pad_t;
+
+static cli_pad_t cli_pads[CLI_MAX_PADS];
+static int cli_num_pads = 0;
+static bool cli_csv = false;
+static unsigned cli_interval_ms = 100;
+
+static char out_header[4096];
+static char out_row[4096];
+static char out_last_header[4096];
+
+// A field as the headless mode reads and writes it: bytes, signed ones
+// from -128 to 127.
+typedef struct
+{
+    char const* name;
+    uint8_t field;
+    uint8_t size; // 0 if it follows the button count; see cli_size().
+    bool is_signed;
+} cli_field_t;
+
+// Settable fields.
+static cli_field_t const cli_fields[] =
+{
+    { "thresholds", FIELD_THRESHOLDS, 0 },
+    { "keys", FIELD_KEYS, 0 },
+    { "mode", FIELD_REPORT_MODE, 1 },
+    { "debounce", FIELD_DEBOUNCE, sizeof(struct debounce_field) },
+    { "link", FIELD_LINK_ROLE, 1 },
+    { "curves", FIELD_CURVES, 0 },
+    { "discard", FIELD_ADC_DISCARD, 1 },
+    { "oversample", FIELD_ADC_OVERSAMPLE, 1 },
+    { "crosstalk", FIELD_CROSSTALK, 0, true },
+    { "tempcomp", FIELD_TEMP_COMP, 0, true },
+    { "excitation", FIELD_EXCITATION, sizeof(struct excitation_field) },
+    { "lights", FIELD_LIGHTS, sizeof(struct lights_field) },
+    { "profile", FIELD_PROFILE, 1 },
+    { "schedule", FIELD_SCHEDULE, sizeof(struct schedule_field) },
+};
+
+// Read-only fields 'get' prints after the settable ones.
+static cli_field_t const cli_readings[] =
+{
+    { "sensors", FIELD_SENSORS, 0 },
+    { "temperature", FIELD_TEMPERATURE, 2 },
+};
+
+// In struct pad_stats order.
+static char const* const stat_names[] =
+{
+    "sof_phase_us",
+    "sof_lead_us",
+    "sof_late",
+    "data_age_us",
+    "data_age_max_us",
+    "wake_latency_us",
+    "boot_enum_us",
+    "boot_report_us",
+    "filter_scalar_cycles",
+    "filter_swar_cycles",
+    "filter_interp_cycles",
+    "link_frames",
+    "link_errors",
+    "sample_pass_us",
+    "adc_noise",
+    "light_push_cycles",
+    "light_latency_us",
+    "report_overflows",
+    "report_coalesced",
+    "channel_0_decisions_hz",
+    "channel_1_decisions_hz",
+    "channel_2_decisions_hz",
+    "channel_3_decisions_hz",
+};
+
+// Size of a field on 'pad', whose button count sizes the per-button ones.
+static int cli_size(cli_field_t const* field, cli_pad_t const* pad)
 {
+    int const n = pad->num_buttons;
+    switch(field->field)
+    {
+    case FIELD_SENSORS:
+    case FIELD_THRESHOLDS:
+    case FIELD_KEYS:
+        return n;
+    case FIELD_CURVES:
+        return n * CURVE_KNOTS;
+    case FIELD_CROSSTALK:
+        return n + n * (n - 1) / 2;
+    case FIELD_TEMP_COMP:
+        return 1 + n;
+    default:
+        return field->size;
+    }
+}
+
+_Static_assert(sizeof(stat_names) / sizeof(*stat_names) * sizeof(uint32_t) == sizeof(struct pad_stats),
+               "stat_names must match struct pad_stats");
+
+static void append(char* buf, size_t size, char const* fmt, ...)
+{
+    size_t const len = strlen(buf);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf + len, size - len, fmt, args);
+    va_end(args);
+}
+
+// Device paths are backslash-separated on Windows.
+static void append_string(char* buf, size_t size, char const* str)
+{
+    if(cli_csv)
+    {
+        append(buf, size, "%s", str);
+        return;
+    }
+
+    append(buf, size, "\"");
+    for(; *str; ++str)
+        append(buf, size, (*str == '"' || *str == '\\') ? "\\%c" : "%c", *str);
+    append(buf, size, "\"");
+}
+
+static void out_begin(cli_pad_t const* pad, char const* command)
+{
+    out_header[0] = out_row[0] = '\0';
+
+    if(cli_csv)
+    {
+        append(out_header, sizeof(out_header), "command,device,serial");
+        append(out_row, sizeof(out_row), "%s,", command);
+        append_string(out_row, sizeof(out_row), pad->path);
+        append(out_row, sizeof(out_row), ",");
+        append_string(out_row, sizeof(out_row), pad->serial);
+    }
+    else
+    {
+        append(out_row, sizeof(out_row), "{\"command\":\"%s\",\"device\":", command);
+        append_string(out_row, sizeof(out_row), pad->path);
+        append(out_row, sizeof(out_row), ",\"serial\":");
+        append_string(out_row, sizeof(out_row), pad->serial);
+    }
+}
+
+// Arrays are a JSON array, or a CSV column per element.
+static void out_field(char const* name, long const* values, int count, bool array)
+{
+    if(cli_csv)
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            if(array)
+                append(out_header, sizeof(out_header), ",%s%i", name, i);
+            else
+                append(out_header, sizeof(out_header), ",%s", name);
+            append(out_row, sizeof(out_row), ",%li", values[i]);
+        }
+        return;
+    }
+
+    append(out_row, sizeof(out_row), ",\"%s\":%s", name, array ? "[" : "");
+    for(int i = 0; i < count; ++i)
+        append(out_row, sizeof(out_row), i ? ",%li" : "%li", values[i]);
+    if(array)
+        append(out_row, sizeof(out_row), "]");
+}
+
+static void out_bytes(char const* name, uint8_t const* data, int count, bool array, bool is_signed)
+{
+    long values[64];
+    if(count > 64)
+        count = 64;
+    for(int i = 0; i < count; ++i)
+        values[i] = is_signed ? (int8_t)data[i] : data[i];
+    out_field(name, values, count, array);
+}
+
+static void out_end(void)
+{
+    if(cli_csv)
+    {
+        if(strcmp(out_header, out_last_header) != 0)
+        {
+            puts(out_header);
+            strcpy(out_last_header, out_header);
+        }
+        puts(out_row);
+    }
+    else
+        printf("%s}\n", out_row);
+
+    fflush(stdout);
+}
+
+static bool cli_error(cli_pad_t const* pad, char const* command, char const* message)
+{
+    fprintf(stderr, "%s: %s: %s\n", pad->path, command, message);
+    return false;
+}
+
+// Sends the batch and checks every result.
+static bool cli_transfer(cli_pad_t const* pad, char const* command)
+{
+    device = pad->handle;
+    if(!batch_send() || !batch_fetch())
+        return cli_error(pad, command, "transfer failed");
+
+    int len;
+    for(int i = 0; i < batch[2]; ++i)
+        if(!batch_result(i, &len))
+            return cli_error(pad, command, "rejected by the pad");
+
+    return true;
+}
+
+// Reads 'count' fields into 'data', in as many batches as it takes for
+// their results to fit in a response. Each result is copied out before
+// the next batch's arrive.
+static bool cli_fetch(cli_pad_t const* pad, char const* command, cli_field_t const* fields, int count,
+                      uint8_t (*data)[COMMAND_DATA_MAX], int* lens)
+{
+    for(int first = 0; first < count;)
+    {
+        unsigned size = sizeof(struct command_header);
+        int n = 0;
+        batch_begin();
+        for(; first + n < count && size + 3 + cli_size(&fields[first + n], pad) <= COMMAND_REPORT_SIZE; ++n)
+        {
+            size += 3 + cli_size(&fields[first + n], pad);
+            batch_op(OP_GET, fields[first + n].field, NULL, 0);
+        }
+        if(!cli_transfer(pad, command))
+            return false;
+
+        for(int i = 0; i < n; ++i)
+        {
+            uint8_t const* const result = batch_result(i, &lens[first + i]);
+            memcpy(data[first + i], result, lens[first + i]);
+        }
+        first += n;
+    }
+    return true;
+}
+
+static bool cli_get(cli_pad_t const* pad)
+{
+    // Every settable field, then the readings.
+    int const num_settable = sizeof(cli_fields) / sizeof(*cli_fields);
+    int const count = num_settable + sizeof(cli_readings) / sizeof(*cli_readings);
+
+    uint8_t data[sizeof(cli_fields) / sizeof(*cli_fields) + sizeof(cli_readings) / sizeof(*cli_readings)][COMMAND_DATA_MAX];
+    int lens[sizeof(cli_fields) / sizeof(*cli_fields) + sizeof(cli_readings) / sizeof(*cli_readings)];
+    if(!cli_fetch(pad, "get", cli_fields, num_settable, data, lens)
+       || !cli_fetch(pad, "get", cli_readings, count - num_settable, data + num_settable, lens + num_settable))
+        return false;
+
+    out_begin(pad, "get");
+    for(int i = 0; i < count; ++i)
+    {
+        cli_field_t const* const field = i < num_settable ? &cli_fields[i] : &cli_readings[i - num_settable];
+        if(field->field == FIELD_TEMPERATURE)
+        {
+            // In 1/16 °C.
+            long const temperature = (lens[i] == 2) ? (int16_t)(data[i][0] | (data[i][1] << 8)) : 0;
+            out_field(field->name, &temperature, 1, false);
+        }
+        else
+            out_bytes(field->name, data[i], lens[i], field->size != 1, field->is_signed);
+    }
+    out_end();
+    return true;
+}
+
+static bool cli_set(cli_pad_t const* pad, char const* name, char const* values)
+{
+    for(unsigned f = 0; f < sizeof(cli_fields) / sizeof(*cli_fields); ++f)
+    {
+        if(strcmp(name, cli_fields[f].name) != 0)
+            continue;
+
+        // Comma-separated, in any base strtol takes.
+        uint8_t data[COMMAND_DATA_MAX];
+        int count = 0;
+        char const* str = values;
+        while(count < (int)sizeof(data))
+        {
+            char* end;
+            long const value = strtol(str, &end, 0);
+            long const min = cli_fields[f].is_signed ? -128 : 0;
+            if(end == str || value < min || value > min + 255)
+                return cli_error(pad, "set", "values must be bytes");
+            data[count++] = value;
+            if(*end != ',')
+                break;
+            str = end + 1;
+        }
+
+        if(count != cli_size(&cli_fields[f], pad))
+            return cli_error(pad, "set", "wrong number of values");
+
+        batch_begin();
+        batch_op(OP_SET, cli_fields[f].field, data, count);
+        if(!cli_transfer(pad, "set"))
+            return false;
+
+        out_begin(pad, "set");
+        out_bytes(name, data, count, cli_fields[f].size != 1, cli_fields[f].is_signed);
+        out_end();
+        return true;
+    }
+
+    return cli_error(pad, "set", "unknown field");
+}
+
+static bool cli_simple(cli_pad_t const* pad, char const* command, uint8_t op)
+{
+    batch_begin();
+    batch_op(op, 0, NULL, 0);
+    if(!cli_transfer(pad, command))
+        return false;
+
+    out_begin(pad, command);
+    out_end();
+    return true;
+}
+
+static bool cli_stats(cli_pad_t const* pad)
+{
+    uint32_t stats[sizeof(stat_names) / sizeof(*stat_names)];
+    unsigned got = 0;
+
+    // Stats are larger than one result, and older firmware has fewer.
+    while(got < sizeof(stats))
+    {
+        batch_begin();
+        batch_op(OP_GET_STATS, got, NULL, 0);
+
+        int len;
+        uint8_t const* data;
+        device = pad->handle;
+        if(!batch_send() || !batch_fetch() || !(data = batch_result(0, &len)) || len <= 0)
+            break;
+        if(len > (int)(sizeof(stats) - got))
+            len = sizeof(stats) - got;
+        memcpy((uint8_t*)stats + got, data, len);
+        got += len;
+    }
+
+    if(got < sizeof(uint32_t))
+        return cli_error(pad, "stats", "unable to read stats");
+
+    out_begin(pad, "stats");
+    for(unsigned i = 0; i < got / sizeof(uint32_t); ++i)
+    {
+        long const value = stats[i];
+        out_field(stat_names[i], &value, 1, false);
+    }
+    out_end();
+    return true;
+}
+
+// Streams sensor readings every cli_interval_ms, forever if count is 0.
+static bool cli_watch(long count)
+{
+    bool ok = true;
+
+    // Leave a polling batch on each pad, so each poll is one transfer.
+    for(int p = 0; p < cli_num_pads; ++p)
+    {
+        batch_begin();
+        batch_op(OP_GET, FIELD_SENSORS, NULL, 0);
+        ok &= cli_transfer(&cli_pads[p], "watch");
+    }
+
+    for(long sample = 0; count == 0 || sample < count; ++sample)
+    {
+        for(int p = 0; p < cli_num_pads; ++p)
+        {
+            int len;
+            uint8_t const* data;
+            device = cli_pads[p].handle;
+            if(!batch_fetch() || !(data = batch_result(0, &len)))
+            {
+                ok = cli_error(&cli_pads[p], "watch", "transfer failed");
+                continue;
+            }
+
+            out_begin(&cli_pads[p], "watch");
+            out_field("sample", &sample, 1, false);
+            out_bytes("sensors", data, len, true, false);
+            out_end();
+        }
+        sleep_ms(cli_interval_ms);
+    }
+
+    return ok;
+}
+
+// Runs the commands in 'tokens' in order.
+static bool cli_run(int count, char** tokens)
+{
+    bool ok = true;
+
+    for(int i = 0; i < count; ++i)
+    {
+        char const* const command = tokens[i];
+
+        if(strcmp(command, "watch") == 0)
+        {
+            long samples = 0;
+            if(i + 1 < count && isdigit((unsigned char)tokens[i + 1][0]))
+                samples = atol(tokens[++i]);
+            ok &= cli_watch(samples);
+            continue;
+        }
+
+        if(strcmp(command, "set") == 0 && i + 2 >= count)
+        {
+            fprintf(stderr, "set: expected a field and values\n");
+            return false;
+        }
+
+        bool known = true;
+        for(int p = 0; p < cli_num_pads && known; ++p)
+        {
+            cli_pad_t const* const pad = &cli_pads[p];
+
+            if(strcmp(command, "list") == 0)
+            {
+                out_begin(pad, "list");
+                out_end();
+            }
+            else if(strcmp(command, "get") == 0)
+                ok &= cli_get(pad);
+            else if(strcmp(command, "set") == 0)
+                ok &= cli_set(pad, tokens[i + 1], tokens[i + 2]);
+            else if(strcmp(command, "save") == 0)
+                ok &= cli_simple(pad, "save", OP_COMMIT);
+            else if(strcmp(command, "stats") == 0)
+                ok &= cli_stats(pad);
+            else if(strcmp(command, "reset-stats") == 0)
+                ok &= cli_simple(pad, "reset-stats", OP_RESET_STATS);
+            else
+                known = false;
+        }
+
+        if(!known)
+        {
+            fprintf(stderr, "Unknown command: %s\n", command);
+            return false;
+        }
+
+        if(strcmp(command, "set") == 0)
+            i += 2;
+    }
+
+    return ok;
+}
+
+// Runs commands from each line of 'fp', for a controlling process.
+static bool cli_script(FILE* fp)
+{
+    char line[1024];
+    bool ok = true;
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        char* tokens[CLI_MAX_TOKENS];
+        int count = 0;
+
+        for(char* token = strtok(line, " \t\r\n"); token && count < CLI_MAX_TOKENS; token = strtok(NULL, " \t\r\n"))
+            tokens[count++] = token;
+
+        if(count && tokens[0][0] != '#')
+            ok &= cli_run(count, tokens);
+    }
+
+    return ok;
+}
+
+// Opens every pad matching 'paths' (all if none) and 'serial' (any if NULL).
+static void cli_open(char const* const* paths, int num_paths, char const* serial)
+{
+    struct hid_device_info* const devices = hid_enumerate(0x16C0, 0x27D9);
+
+    for(struct hid_device_info* d = devices; d && cli_num_pads < CLI_MAX_PADS; d = d->next)
+    {
+        if(!is_pubby_pad(d))
+            continue;
+
+        cli_pad_t* const pad = &cli_pads[cli_num_pads];
+        snprintf(pad->path, sizeof(pad->path), "%s", d->path);
+        snprintf(pad->serial, sizeof(pad->serial), "%ls", d->serial_number ? d->serial_number : L"");
+
+        bool match = num_paths == 0;
+        for(int i = 0; i < num_paths; ++i)
+            match |= strcmp(paths[i], pad->path) == 0;
+        if(!match || (serial && strcmp(serial, pad->serial) != 0))
+            continue;
+
+        if(!(pad->handle = hid_open_path(d->path)))
+        {
+            fprintf(stderr, "%s: unable to open\n", pad->path);
+            continue;
+        }
+
+        // Per-button fields are sized by the pad's button count.
+        device = pad->handle;
+        read_info();
+        pad->num_buttons = num_buttons;
+        ++cli_num_pads;
+    }
+
+    hid_free_enumeration(devices);
+}
+
+static void cli_usage(char const* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-d path]... [-s serial] [-f json|csv] [-i ms] command...\n"
+            "Commands run in order on every selected pad (default: all pads):\n"
+            "  list                  list the pads\n"
+            "  get                   print every field set takes, then the sensor readings\n"
+            "  set FIELD V[,V...]    set thresholds, keys, mode, debounce, link,\n"
+            "                        curves, discard, oversample, crosstalk, tempcomp,\n"
+            "                        excitation, lights, profile or schedule\n"
+            "  save                  save changed profiles to flash now\n"
+            "  stats                 print the pad's stats\n"
+            "  reset-stats           clear counters and maxima\n"
+            "  watch [N]             print sensor readings every -i ms, N times or forever\n"
+            "  -                     read commands from stdin, one line at a time\n"
+            "Without a command, starts the interactive interface.\n",
+            argv0);
+}
+
+int cli_main(int argc, char** argv)
+{
+    char const* paths[CLI_MAX_PADS];
+    int num_paths = 0;
+    char const* serial = NULL;
+    int i = 1;
+
+    for(; i < argc && argv[i][0] == '-' && argv[i][1]; ++i)
+    {
+        bool const has_value = i + 1 < argc;
+
+        if(strcmp(argv[i], "-d") == 0 && has_value && num_paths < CLI_MAX_PADS)
+            paths[num_paths++] = argv[++i];
+        else if(strcmp(argv[i], "-s") == 0 && has_value)
+            serial = argv[++i];
+        else if(strcmp(argv[i], "-f") == 0 && has_value)
+            cli_csv = strcmp(argv[++i], "csv") == 0;
+        else if(strcmp(argv[i], "-i") == 0 && has_value)
+            cli_interval_ms = atoi(argv[++i]);
+        else
+        {
+            cli_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(i == argc)
+    {
+        cli_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(hid_init() != 0)
+    {
+        fwprintf(stderr, L"HID Error: %ls\n", hid_error(NULL));
+        return EXIT_FAILURE;
+    }
+
+    cli_open(paths, num_paths, serial);
+    if(cli_num_pads == 0)
+    {
+        fprintf(stderr, "No pads found.\n");
+        hid_exit();
+        return EXIT_FAILURE;
+    }
+
+    bool const ok = (strcmp(argv[i], "-") == 0) ? cli_script(stdin) : cli_run(argc - i, argv + i);
+
+    for(int p = 0; p < cli_num_pads; ++p)
+        hid_close(cli_pads[p].handle);
+    hid_exit();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+        return cli_main(argc, argv);
+
 
     // Init ncurses:
     initscr();
@@ -142,28 +1184,35 @@ int main(void)
         return EXIT_FAILURE;
     }
 
+    monitor_init();
     enumerate();
-    find_next_entry();
-    read_thresholds();
+    reconnect();
     read_sensors();
 
     while(true)
     {
         poll_mode(true);
+        monitor_poll();
         read_sensors();
 
         int line = 0;
         mvprintw(line++, 0, "Pad Sensor Thresholds: %s", device_name);
         mvprintw(line++, 0, "[Tab]: Toggle device  [Enter]: Set Value  [c]: Calibrate");
         mvprintw(line++, 0, "[s]: Save Profile     [l]: Load Profile   [q]: Quit");
+        mvprintw(line++, 0, "[k]: Set Key          [m]: Report Mode (%s)", report_mode_name());
+        clrtoeol();
+        mvprintw(line++, 0, "[f]: Calibrate Force Curve  [p]: Pad Link (%s)", link_role_name());
+        clrtoeol();
+        clrtoeol();
         line++;
 
-        for(int i = 0; i < 4; ++i)
+        for(int i = 0; i < num_buttons; ++i)
         {
             if(i == ui_line)
                 attron(A_REVERSE);
-            mvprintw(line++, 2, "Button %i: %3i", i, thresholds[i]);
+            mvprintw(line, 2, "Button %i: %3i", i, thresholds[i]);
             attroff(A_REVERSE);
+            mvprintw(line++, 20, "Key: 0x%02X", keys[i]);
 
             mvprintw(line++, 6, "%3i ", sensors[i]);
             attron(COLOR_PAIR(CP_BAR_PRE));
@@ -184,10 +1233,13 @@ int main(void)
         if(!device)
         {
             attron(COLOR_PAIR(CP_ERROR));
-            printw("Error: Unable to access USB device.\n");
+            if(current_pad < 0 && current_serial[0])
+                printw("Pad %ls is gone; waiting for it to come back.\n", current_serial);
+            else
+                printw("Error: Unable to access USB device.\n");
             attroff(COLOR_PAIR(CP_ERROR));
         }
-        clrtoeol();
+        clrtobot(); // Rows of a pad with more buttons.
 
         refresh();
 
@@ -196,7 +1248,7 @@ int main(void)
         case KEY_EXIT:
         case 'q':
         case 'Q':
-            write_thresholds();
+            write_config();
             goto exit;
 
         case 'c':
@@ -204,18 +1256,16 @@ int main(void)
             break;
 
         case 'C':
-            for(int i = 0; i < 4; ++i)
+            for(int i = 0; i < num_buttons; ++i)
                 thresholds[i] = sensors[i];
             break;
 
         case KEY_DOWN:
-            ++ui_line;
-            ui_line &= 3;
+            ui_line = (ui_line + 1) % num_buttons;
             break;
 
         case KEY_UP:
-            --ui_line;
-            ui_line &= 3;
+            ui_line = (ui_line + num_buttons - 1) % num_buttons;
             break;
 
         case KEY_LEFT:
@@ -236,9 +1286,49 @@ int main(void)
 
         case '\t':
         case KEY_STAB:
-            write_thresholds();
-            find_next_entry();
-            read_thresholds();
+            write_config();
+            next_pad();
+            read_config();
+            break;
+
+        case 'k':
+        case 'K':
+            poll_mode(false);
+            printw("Key usage (e.g. 0x50): ");
+            getnstr(io_buf, sizeof(io_buf));
+            io_buf[sizeof(io_buf)-1] = '\0';
+            // Hex, with or without the 0x; anything else leaves the key as it was.
+            if(isxdigit(io_buf[0]))
+            {
+                char* end;
+                long value = strtol(io_buf, &end, 16);
+                if(*end == '\0' && value >= 0 && value <= 255)
+                    keys[ui_line] = value;
+            }
+            break;
+
+        case 'f':
+        case 'F':
+            poll_mode(false);
+            calibrate_curve(ui_line);
+            break;
+
+        case 'p':
+        case 'P':
+            if(link_role >= 0)
+            {
+                link_role = (link_role + 1) % 3;
+                write_link_role();
+            }
+            break;
+
+        case 'm':
+        case 'M':
+            if(report_mode)
+            {
+                uint8_t const mode = report_mode & (REPORT_MODE_GAMEPAD | REPORT_MODE_KEYBOARD);
+                report_mode ^= mode ^ (mode % 3 + 1);
+            }
             break;
 
         case KEY_ENTER:
@@ -304,8 +1394,8 @@ exit:
 #ifndef _WIN32
     endwin(); // Not sure why this doesn't link on PDCURSES
 #endif
-    hid_close(device);
-    hid_free_enumeration(enumeration);
+    close_pad();
+    monitor_exit();
     hid_exit();
     return 0;
 }
@@ -0,0 +1,23 @@
+#include <string.h>
+
+#include "tusb.h"
+
+#include "keyboard.h"
+
+void keyboard_build(keyboard_report_t* report, buttons_t buttons, uint8_t const* keymap)
+{
+    memset(report, 0, sizeof(*report));
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        if(!(buttons & (1 << i)))
+            continue;
+
+        uint8_t const key = keymap[i];
+
+        if(key >= HID_KEY_CONTROL_LEFT && key <= HID_KEY_GUI_RIGHT)
+            report->modifiers |= 1 << (key - HID_KEY_CONTROL_LEFT);
+        else if(key != HID_KEY_NONE && key < NKRO_KEYS)
+            report->keys[key / 8] |= 1 << (key % 8);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+
+// Key usages 0x00-0x7F get a bit each in the NKRO bitmap.
+// The modifiers (0xE0-0xE7) have their own byte.
+#define NKRO_KEYS 128
+
+typedef struct
+{
+    uint8_t modifiers;
+    uint8_t keys[NKRO_KEYS / 8];
+} keyboard_report_t;
+
+void keyboard_build(keyboard_report_t* report, buttons_t buttons, uint8_t const* keymap);
+
+#endif /* KEYBOARD_H_ */
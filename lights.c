@@ -0,0 +1,166 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "ws2812.pio.h"
+
+#include "lights.h"
+#include "pipeline.h"
+#include "config.h"
+#include "stats.h"
+#include "cycles.h"
+
+#define LED_COUNT (NUM_BUTTONS * PAD_PANEL_LEDS)
+
+// A pixel takes 30 us to shift out at 800 kHz, and the chain latches
+// once the line stays low for 50 us. A new frame before then would
+// carry on into the LEDs further down the chain.
+#define FRAME_US (LED_COUNT * 30 + 80)
+
+#define FADE_STEP_US 4000
+#define LEVEL_MAX 0xFFFF
+
+static PIO const pio = pio0;
+static int dma_channel = -1;
+static uint32_t pixels[LED_COUNT]; // GRB in the top 24 bits, as the PIO program shifts them out.
+
+static buttons_t held = 0;
+static uint16_t levels[NUM_BUTTONS]; // Brightness of each panel.
+static bool resync = true; // Take the state from the debouncer, after a blank.
+static bool dirty = false; // Levels changed since the last frame.
+static uint32_t frame_us = 0; // Start of the last frame.
+static uint32_t fade_us = 0;
+static bool edge_pending = false; // An edge waits for its frame.
+static uint32_t pending_edge_us = 0;
+
+// Queueing an edge is the only work the lights add to a sample pass.
+void lights_benchmark(void)
+{
+    static edge_queue_t scratch;
+    edge_queue_t* volatile const queue = &scratch;
+
+    cycles_start();
+    uint32_t const start = cycles_now();
+    for(int i = 0; i < EDGE_QUEUE_SIZE; ++i)
+        edge_queue_push(queue, i, i);
+    stats.light_push_cycles = cycles_since(start) / EDGE_QUEUE_SIZE;
+    cycles_stop();
+}
+
+void lights_init(void)
+{
+    uint const sm = pio_claim_unused_sm(pio, true);
+    uint const offset = pio_add_program(pio, &ws2812_program);
+    // 24 bits per pixel, so that chained RGB LEDs line up.
+    ws2812_program_init(pio, sm, offset, PAD_LED_PIN, 800000, false);
+
+    dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(dma_channel);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(dma_channel, &cfg, &pio->txf[sm], pixels, LED_COUNT, false);
+}
+
+// Steps the fade of released panels. Returns whether any level changed.
+static bool fade(void)
+{
+    // Steps in 1/65535ths of full brightness, so that long fades still move.
+    uint32_t const duration_us = config.lights.fade_time * 10000;
+    uint32_t const step = duration_us ? (uint64_t)LEVEL_MAX * FADE_STEP_US / duration_us : LEVEL_MAX;
+
+    bool changed = false;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        if(held & (1 << i) || !levels[i])
+            continue;
+        levels[i] = levels[i] > step ? levels[i] - step : 0;
+        changed = true;
+    }
+    return changed;
+}
+
+// Lights pressed panels at once, even ones released by a later edge in
+// the same batch; releases fade on the step clock.
+static void light(buttons_t buttons)
+{
+    held = buttons;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        if(buttons & (1 << i))
+            levels[i] = LEVEL_MAX;
+    dirty = true;
+}
+
+static void render(void)
+{
+    uint8_t const* const color = config.lights.color;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        uint32_t const level = config.lights.mode == LIGHTS_OFF ? 0 : levels[i];
+        uint32_t const r = color[0] * level / LEVEL_MAX;
+        uint32_t const g = color[1] * level / LEVEL_MAX;
+        uint32_t const b = color[2] * level / LEVEL_MAX;
+        uint32_t const pixel = g << 24 | r << 16 | b << 8;
+        for(int led = 0; led < PAD_PANEL_LEDS; ++led)
+            pixels[i * PAD_PANEL_LEDS + led] = pixel;
+    }
+}
+
+void lights_task(void)
+{
+    if(dma_channel < 0)
+        return;
+
+    edge_t edge;
+    while(edge_queue_pop(&light_edges, &edge))
+    {
+        light(edge.buttons);
+        if(!edge_pending)
+            pending_edge_us = edge.time_us;
+        edge_pending = true;
+    }
+
+    if(resync)
+    {
+        resync = false;
+        light(debouncer.buttons);
+    }
+
+    uint32_t const now = time_us_32();
+    if(now - fade_us >= FADE_STEP_US)
+    {
+        fade_us = now;
+        dirty |= fade();
+    }
+
+    if(!dirty || now - frame_us < FRAME_US || dma_channel_is_busy(dma_channel))
+        return;
+
+    render();
+    dma_channel_transfer_from_buffer_now(dma_channel, pixels, LED_COUNT);
+    frame_us = now;
+    dirty = false;
+
+    if(edge_pending)
+    {
+        stats.light_latency_us = now - pending_edge_us;
+        edge_pending = false;
+    }
+}
+
+void lights_blank(void)
+{
+    if(dma_channel < 0)
+        return;
+
+    while(time_us_32() - frame_us < FRAME_US || dma_channel_is_busy(dma_channel))
+        tight_loop_contents();
+
+    memset(levels, 0, sizeof(levels));
+    memset(pixels, 0, sizeof(pixels));
+    dma_channel_transfer_from_buffer_now(dma_channel, pixels, LED_COUNT);
+    frame_us = time_us_32();
+    resync = true;
+}
@@ -0,0 +1,22 @@
+#ifndef LIGHTS_H_
+#define LIGHTS_H_
+
+// Per-panel lighting on the WS2812 chain: PAD_PANEL_LEDS per panel, in
+// button order. The decision pipeline queues its edges in light_edges;
+// lights_task() renders from the main loop and a DMA channel feeds the
+// PIO program, so a sample pass never waits on the LEDs.
+
+// Claims a PIO state machine and a DMA channel.
+void lights_init(void);
+
+// Times queueing an edge, into stats.light_push_cycles.
+void lights_benchmark(void);
+
+// Takes queued edges, steps fades and starts a frame when one is due.
+void lights_task(void);
+
+// Turns every LED off, waiting for a frame in flight. Fades restart
+// from dark at the next lights_task().
+void lights_blank(void);
+
+#endif /* LIGHTS_H_ */
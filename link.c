@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+
+#include "link.h"
+#include "config.h"
+#include "stats.h"
+
+#define LINK_UART PAD_LINK_UART
+#define LINK_TX_PIN PAD_LINK_TX_PIN
+#define LINK_RX_PIN PAD_LINK_RX_PIN
+#define LINK_BAUD 1000000
+
+#define LINK_SYNC 0xA5
+#define FRAME_SIZE 5
+#define FRAME_US (FRAME_SIZE * 10 * 1000000 / LINK_BAUD) // 10 bits per byte on the wire.
+#define KEEPALIVE_US 1000
+#define TIMEOUT_US 10000
+
+static uint8_t window[FRAME_SIZE];
+static unsigned window_size = 0;
+
+static buttons_t remote_buttons = 0;
+static uint32_t frame_us = 0; // When the last good frame arrived.
+
+edge_queue_t link_edges = { .overflows = &stats.report_overflows, .coalesced = &stats.report_coalesced };
+
+static buttons_t sent_buttons = 0;
+static uint32_t sent_us = 0;
+
+static uint8_t checksum(uint8_t const* frame)
+{
+    return ~(frame[1] + frame[2] + frame[3]);
+}
+
+static void remote_edge(buttons_t buttons, uint32_t time_us)
+{
+    remote_buttons = buttons;
+    edge_queue_push(&link_edges, buttons, time_us);
+}
+
+void link_init(void)
+{
+    if(config.link_role != LINK_PRIMARY && remote_buttons)
+        remote_edge(0, time_us_32());
+
+    if(config.link_role != LINK_PRIMARY && config.link_role != LINK_SECONDARY)
+        return;
+
+    uart_init(LINK_UART, LINK_BAUD);
+    gpio_set_function(LINK_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(LINK_RX_PIN, GPIO_FUNC_UART);
+}
+
+void link_send(buttons_t buttons, uint32_t edge_us, uint32_t now)
+{
+    if(buttons == sent_buttons && now - sent_us < KEEPALIVE_US)
+        return;
+
+    uint32_t age = now - edge_us;
+    if(age > 0xFFFF)
+        age = 0xFFFF;
+
+    uint8_t frame[FRAME_SIZE] = { LINK_SYNC, buttons, age, age >> 8 };
+    frame[4] = checksum(frame);
+
+    // A frame every sample pass at most never fills the FIFO, so this doesn't block.
+    uart_write_blocking(LINK_UART, frame, sizeof(frame));
+    sent_buttons = buttons;
+    sent_us = now;
+}
+
+buttons_t link_poll(uint32_t now)
+{
+    edge_queue_flush(&link_edges);
+
+    while(uart_is_readable(LINK_UART))
+    {
+        // Slide over the stream a byte at a time until the window holds a
+        // valid frame, which resynchronizes after noise or a restart.
+        if(window_size == FRAME_SIZE)
+        {
+            memmove(window, window + 1, FRAME_SIZE - 1);
+            --window_size;
+            ++stats.link_errors;
+        }
+        window[window_size++] = uart_getc(LINK_UART);
+
+        if(window_size == FRAME_SIZE && window[0] == LINK_SYNC && window[4] == checksum(window))
+        {
+            uint32_t const age = window[2] | (window[3] << 8);
+            if(window[1] != remote_buttons)
+                remote_edge(window[1], now - FRAME_US - age);
+            frame_us = now;
+            window_size = 0;
+            ++stats.link_frames;
+        }
+    }
+
+    if(remote_buttons && now - frame_us > TIMEOUT_US)
+        remote_edge(0, now);
+
+    return remote_buttons;
+}
@@ -0,0 +1,32 @@
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+#include "edge_queue.h"
+
+// Pad link. In doubles cabinets, a secondary pad streams its debounced
+// buttons over a UART to the primary. The primary reports both pads as one
+// USB device, so both players share one polling phase and one USB port.
+//
+// Each frame is: LINK_SYNC, buttons, age (uint16_t, us), checksum.
+// The age is how long before sending the buttons last changed, so the
+// primary can place the edge on its own clock.
+
+// Sets up the UART for config.link_role. Leaving the primary role
+// releases the secondary's buttons.
+void link_init(void);
+
+// Secondary: sends changed buttons at once, and unchanged ones as a keep-alive.
+void link_send(buttons_t buttons, uint32_t edge_us, uint32_t now);
+
+// Primary: every change of the secondary's buttons, placed on this pad's
+// clock, until it's reported. Coalesces like report_edges.
+extern edge_queue_t link_edges;
+
+// Primary: takes in received frames, queueing edges in link_edges.
+// Returns the secondary's buttons. They release if the link goes quiet.
+buttons_t link_poll(uint32_t now);
+
+#endif /* LINK_H_ */
@@ -3,127 +3,175 @@
 #include <string.h>
 
 #include "pico/stdlib.h"
-#include "hardware/pio.h"
 #include "hardware/clocks.h"
 #include "hardware/flash.h"
 #include "hardware/adc.h"
-#include "ws2812.pio.h"
+#include "hardware/uart.h"
 
 #include "tusb.h"
 #include "bsp/board.h"
 
 #include "usb_descriptors.h"
+#include "pad.h"
+#include "config.h"
+#include "keyboard.h"
+#include "debounce.h"
+#include "pipeline.h"
+#include "capture.h"
+#include "sof.h"
+#include "stats.h"
+#include "command.h"
+#include "curve.h"
+#include "crosstalk.h"
+#include "thermal.h"
+#include "filter.h"
+#include "link.h"
+#include "lights.h"
+#include "schedule.h"
 
-const int NUM_BUTTONS = 4;
-const int SENSOR_PADDING = 2;
-const int PIN_TX = 16;
+const int PWM_PIN = PAD_PWM_PIN;
+const int EXCITE_PIN = PAD_EXCITE_PIN;
 
-const int FIRST_PIN = 26;
+const int SAMPLE_US = 250;
 
-typedef uint8_t force_t;
-typedef uint8_t buttons_t;
+// Sampling period while the bus is suspended.
+const int SUSPEND_POLL_US = 2000;
 
-static force_t sensors[4] = { 1, 2, 3, 4 };
-static force_t thresholds[4] = { 5, 6, 7, 8 };
-static uint8_t prev_buttons = 0; 
+const int FIRST_PIN = 26; // ADC input 0.
 
-static PIO pio;
+static uint8_t const adc_inputs[NUM_BUTTONS] = PAD_ADC_INPUTS;
 
-static inline void put_pixel(uint32_t pixel_grb) {
-  pio_sm_put_blocking(pio0, 0, pixel_grb << 8u);
-}
+// The temperature sensor is read once every this many passes, about a second.
+const int TEMPERATURE_PASSES = 4000;
 
-static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b) {
-  return ((uint32_t)(r) << 8) |
-         ((uint32_t)(g) << 16) |
-         (uint32_t)(b);
-}
+static uint16_t prev_buttons = 0; // As last reported, with a linked pad in the high byte.
+static buttons_t remote_buttons = 0; // The secondary's, as the primary last polled them.
+static uint32_t sample_us = 0;
+
+static keyboard_report_t keyboard;
+static bool keyboard_pending = false;
+
+static bool remote_wakeup = false;
+static bool wake_requested = false;
+static uint32_t wake_us = 0; // Start of the last wake, 0 once its first report is out.
+static uint32_t run_clock_khz = 0; // System clock to go back to on resume.
+
+struct pad_stats stats;
+
+static bool late_init_done = false;
+static bool report_pending = false; // Send the state even if unchanged.
 
 void hid_task(void);
+void link_task(void);
 void tud_task(void);
 
-int main(void)
+// Setup nothing in enumeration or sampling depends on,
+// run once the host has configured the device.
+static void late_init(void)
 {
     stdio_init_all();
-    read_thresholds();
+
+    lights_benchmark();
+
+    // Leaves interp0 set up for the filter too.
+    filter_benchmark();
+
+    late_init_done = true;
+}
+
+// Holding every panel for PROFILE_CHORD_MS switches to the next profile.
+// A single panel has no chord.
+static void chord_task(void)
+{
+    static bool held = false;
+    static bool switched = false;
+    static uint32_t held_us = 0;
+
+    if(NUM_BUTTONS < 2 || debouncer.buttons != (1 << NUM_BUTTONS) - 1)
+    {
+        held = false;
+        switched = false;
+        return;
+    }
+
+    uint32_t const now = time_us_32();
+    if(!held)
+    {
+        held = true;
+        held_us = now;
+    }
+    else if(!switched && now - held_us >= PROFILE_CHORD_MS * 1000)
+    {
+        switched = true;
+        profile_switch((profile_active() + 1) % PROFILE_COUNT);
+    }
+}
+
+int main(void)
+{
+    // Bring USB up first; cabinets power-cycle with the host, and a pad
+    // that enumerates late can be missed by the game.
+    tud_init(BOARD_TUD_RHPORT);
+
+    read_config();
+    curve_update();
+    crosstalk_update();
+    thermal_update();
 
     uint32_t const initial_millis = board_millis();
 
     // Enabling PWM reduces ADC noise.
-    int const PWM_PIN = 23;
     gpio_init(PWM_PIN);
     gpio_set_dir(PWM_PIN, GPIO_OUT);
     gpio_put(PWM_PIN, 1);
+    gpio_init(EXCITE_PIN);
+    gpio_set_dir(EXCITE_PIN, GPIO_OUT);
+    gpio_put(EXCITE_PIN, 1);
 
-    pio = pio0;
-    int sm = 0;
-    uint offset = pio_add_program(pio, &ws2812_program);
     char str[12];
 
-    ws2812_program_init(pio, sm, offset, PIN_TX, 800000, true);
-
-    // init device stack on configured roothub port
-    tud_init(BOARD_TUD_RHPORT);
-
+    // Channels are selected one at a time, so that a channel can be
+    // converted more than once after the mux switches to it.
     adc_init();
-    adc_set_round_robin(0xF);
+    adc_set_temp_sensor_enabled(true);
+
+    for(unsigned i = 0; i < NUM_BUTTONS; ++i)
+        adc_gpio_init(FIRST_PIN + adc_inputs[i]);
 
+    filter_init();
+    link_init();
 
-    for(unsigned i = 0; i < 4; ++i)
-        adc_gpio_init(FIRST_PIN + i);
+    // A secondary pad may run without a host, so the lights don't wait for one.
+    lights_init();
 
     while(true)
     {
-        if(board_button_read())
-            put_pixel(urgb_u32(0x10, 0x00, 0x00));
+        if(tud_suspended())
+        {
+            // Sleep until the next slow sample or a bus event.
+            best_effort_wfe_or_timeout(make_timeout_time_us(SUSPEND_POLL_US));
+        }
         else
-            put_pixel(urgb_u32(0x0, 0x0, 0x0));
+        {
+            if(!late_init_done && tud_mounted())
+                late_init();
+            lights_task();
+        }
 
         tud_task();
-        hid_task();
-    }
-}
+        if(config.link_role == LINK_SECONDARY)
+            link_task();
+        else
+            hid_task();
 
-#define FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
-#define FLASH_ADDR ((uint8_t*)(XIP_BASE + FLASH_OFFSET))
+        chord_task();
 
-int find_flash_offset(void)
-{
-    for(int i = 0; i < FLASH_SECTOR_SIZE; i += sizeof(thresholds))
-    {
-        for(unsigned j = 0; j < sizeof(thresholds); ++j)
-            if(FLASH_ADDR[i + j] != 0xFF)
-                goto next;
-        return i;
-    next:;
+        // Saving stalls the CPU, and a linked primary's UART with it, so it
+        // waits for a moment with no press on either pad.
+        bool const remote_held = config.link_role == LINK_PRIMARY && remote_buttons;
+        if(!debouncer.buttons && !remote_held)
+            config_task();
     }
-
-    return FLASH_SECTOR_SIZE;
-}
-
-void read_thresholds(void)
-{
-    int const offset = find_flash_offset();
-    if(offset > 0)
-        memcpy(thresholds, FLASH_ADDR + offset - sizeof(thresholds), sizeof(thresholds));
-    else
-        memset(thresholds, 127, sizeof(thresholds));
-}
-
-void save_thresholds(void)
-{
-    unsigned const offset = find_flash_offset() % FLASH_SECTOR_SIZE;
-    unsigned const page_offset = offset & ~(FLASH_PAGE_SIZE-1);
-    uint8_t page[FLASH_PAGE_SIZE];
-
-    memset(page , 0xFF, sizeof(page));
-    memcpy(page + (offset % FLASH_PAGE_SIZE), thresholds, sizeof(thresholds));
-
-    uint32_t const ints = save_and_disable_interrupts();
-    if(offset == 0)
-        flash_range_erase(FLASH_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_OFFSET + page_offset, page, FLASH_PAGE_SIZE);
-    restore_interrupts(ints);
 }
 
 //--------------------------------------------------------------------+
@@ -133,6 +181,12 @@ void save_thresholds(void)
 // Invoked when device is mounted
 void tud_mount_cb(void)
 {
+    // The timer starts at reset, so this is time since reset.
+    if(!stats.boot_enum_us)
+        stats.boot_enum_us = time_us_32();
+
+    // Tell the host the current state without waiting for a change.
+    report_pending = true;
 }
 
 // Invoked when device is unmounted
@@ -140,81 +194,342 @@ void tud_umount_cb(void)
 {
 }
 
+// clk_peri runs off the system clock, so the UARTs' dividers have to
+// follow a clock change.
+static void clocks_changed(void)
+{
+#if LIB_PICO_STDIO_UART && defined(uart_default)
+    if(late_init_done)
+        uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+    link_init();
+}
+
 // Invoked when usb bus is suspended
+// remote_wakeup_en : if host allow us  to perform remote wakeup
 void tud_suspend_cb(bool remote_wakeup_en)
 {
+    remote_wakeup = remote_wakeup_en;
+    wake_requested = false;
+
+    lights_blank();
+    gpio_put(PWM_PIN, 0); // Power-saving regulator mode.
+    hw_clear_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+    run_clock_khz = clock_get_hz(clk_sys) / 1000;
+    set_sys_clock_48mhz();
+    clocks_changed();
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
+    set_sys_clock_khz(run_clock_khz, true);
+    clocks_changed();
+    gpio_put(PWM_PIN, 1);
+    hw_set_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+
+    // Host-initiated wakes are timed from here.
+    if(!wake_requested)
+        wake_us = time_us_32();
 }
 
 //--------------------------------------------------------------------+
 // USB HID
 //--------------------------------------------------------------------+
 
-void poll_sensors(void)
+// Reads one channel. The first conversions after the mux switches can
+// be thrown away while it settles, and the rest are averaged.
+static uint16_t read_channel(unsigned channel)
 {
-    adc_select_input(0);
+    adc_select_input(channel);
 
-    force_t new_reading[4];
-    for(int i = 0; i < NUM_BUTTONS; ++i)
-        new_reading[i] = ~(adc_read() >> 4);
+    for(unsigned i = MIN(config.adc_discard, ADC_DISCARD_MAX); i > 0; --i)
+        adc_read();
+
+    unsigned const count = MIN(MAX(config.adc_oversample, 1), ADC_OVERSAMPLE_MAX);
+    unsigned sum = 0;
+    for(unsigned i = 0; i < count; ++i)
+        sum += adc_read();
+    return sum / count;
+}
+
+// Powers the FSR dividers, with the regulator in PWM mode for less
+// ripple unless the bus is suspended.
+static void excite(bool on)
+{
+    gpio_put(PWM_PIN, on && !tud_suspended());
+    gpio_put(EXCITE_PIN, on);
+}
+
+// Tracks how much released buttons' readings move from pass to pass.
+// Channels the pass held don't count.
+static void measure_noise(uint16_t const* raw, buttons_t held)
+{
+    static uint16_t prev_raw[NUM_BUTTONS];
+    static int32_t noise = 0; // 64 times stats.adc_noise, averaging over 64 readings.
 
     for(int i = 0; i < NUM_BUTTONS; ++i)
-        sensors[i] = ((sensors[i] * 3) + new_reading[i]) / 4;
+    {
+        if(held & (1 << i))
+            continue;
+        if(!(debouncer.buttons & (1 << i)))
+            noise += abs(raw[i] - prev_raw[i]) * 16 - noise / 64;
+        prev_raw[i] = raw[i];
+    }
+
+    stats.adc_noise = noise / 64;
 }
 
-buttons_t read_buttons(void)
+// Whether poll_sensors() converts a slot of a pass at a time. Suspended,
+// it samples too rarely for that, and converts whole passes.
+static bool slotted(void)
 {
-    buttons_t buttons = prev_buttons;
+    return config.schedule.mode == SCHEDULE_ADAPTIVE && !tud_suspended();
+}
 
+// How often poll_sensors() runs: once a pass, or once a slot.
+static uint32_t poll_interval_us(void)
+{
+    return slotted() ? SAMPLE_US / NUM_BUTTONS : SAMPLE_US;
+}
+
+// One sampling and decision pass, run on the sample clock. With the
+// adaptive schedule, one slot of a pass instead: the pass's NUM_BUTTONS
+// conversions are spread over it, one a slot, and the schedule picks the
+// channel for each. A busy channel with several slots is read and decided
+// several times a pass.
+void poll_sensors(void)
+{
+    // Pulsed excitation waits the same settling time every pass,
+    // so the sample clock keeps a fixed phase.
+    bool const pulsed = config.excitation.mode == EXCITE_PULSED;
+    uint32_t const start_us = time_us_32();
+    excite(true);
+    if(pulsed)
+        busy_wait_us_32(MIN(config.excitation.settle_us, EXCITE_SETTLE_MAX_US));
+
+    static uint8_t slots[NUM_BUTTONS];
+    static int slot = NUM_BUTTONS; // Next slot of the pass.
+    buttons_t converted = ALL_BUTTONS;
+    if(slotted())
+    {
+        if(slot >= NUM_BUTTONS)
+        {
+            schedule_plan(slots);
+            slot = 0;
+        }
+        converted = 1 << slots[slot++];
+    }
+    else
+        slot = NUM_BUTTONS;
+
+    // The schedule changes the conversion order from pass to pass, so the
+    // mux crosstalk term follows the channel each was actually converted
+    // after. The temperature sensor counts as no channel.
+    static uint8_t before[NUM_BUTTONS];
+    static uint8_t last = NUM_BUTTONS - 1;
+
+    // Channels not converted are held: the pipeline keeps their last
+    // reading, and the frame marks them.
+    capture_frame_t* const frame = capture_begin();
+    sample_us = time_us_32();
+    UNROLL_BUTTONS
     for(int i = 0; i < NUM_BUTTONS; ++i)
     {
-        buttons_t const button = 1 << i;
+        if(converted & (1 << i))
+        {
+            frame->raw[i] = read_channel(adc_inputs[i]);
+            before[i] = last;
+            last = i;
+        }
+        else
+            frame->raw[i] = 0;
+    }
+    buttons_t const held = ~converted & ALL_BUTTONS;
+    frame->held = held;
+
+    if(pulsed)
+        excite(false);
+    stats.sample_pass_us = time_us_32() - start_us;
+    measure_noise(frame->raw, held);
+    schedule_count(converted, sample_us);
+
+    pipeline_run(frame->raw, held, before, sample_us);
+    capture_end();
+
+    if(slot < NUM_BUTTONS)
+        return;
+
+    // An extra conversion now and then, so the buttons keep their rate.
+    static int temperature_passes = 0;
+    if(++temperature_passes >= TEMPERATURE_PASSES)
+    {
+        temperature_passes = 0;
+        thermal_sample(read_channel(4));
+        last = NUM_BUTTONS;
+    }
+}
+
+// While suspended, sample slowly with the ADC powered down between passes,
+// and wake the host on a press, on either pad of a linked pair. The press
+// itself stays queued, in report_edges or link_edges, and is reported
+// after resume.
+static void suspend_task(void)
+{
+    static uint32_t prev_us = 0;
+    uint32_t const now = time_us_32();
+
+    if(now - prev_us < SUSPEND_POLL_US)
+        return;
+    prev_us = now;
 
-        if(sensors[i] < thresholds[i] - SENSOR_PADDING)
-            buttons &= ~button;
-        else if(sensors[i] >= thresholds[i] + SENSOR_PADDING)
-            buttons |= button;
+    hw_set_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+    while(!(adc_hw->cs & ADC_CS_READY_BITS))
+        tight_loop_contents();
+    poll_sensors();
+    hw_clear_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+
+    buttons_t remote = prev_buttons >> 8;
+    if(config.link_role == LINK_PRIMARY)
+        remote = remote_buttons = link_poll(now);
+
+    uint16_t const pressed = (debouncer.buttons | (remote << 8)) & ~prev_buttons;
+
+    if(pressed && remote_wakeup && !wake_requested)
+    {
+        wake_requested = true;
+        wake_us = time_us_32();
+        tud_remote_wakeup();
     }
+}
 
-    return buttons;
+// As the secondary of a linked pair, samples on the same clock
+// and streams the buttons to the primary instead of reporting them.
+void link_task(void)
+{
+    static uint32_t prev_us = 0;
+    uint32_t const now = time_us_32();
+
+    if(now - prev_us < poll_interval_us())
+        return;
+    prev_us = now;
+
+    poll_sensors();
+    link_send(debouncer.buttons, edge_us, now);
+
+    // The primary reports this pad's edges, and there's no secondary here.
+    edge_t edge;
+    while(edge_queue_pop(&report_edges, &edge) || edge_queue_pop(&link_edges, &edge))
+        ;
 }
 
-// Every ms, we will sent 1 report for each HID profile (keyboard, mouse etc ..)
-// tud_hid_report_complete_cb() is used to send the next report after previous one is complete
+// Sends the oldest edge queued by either pad, or the current state if
+// none is queued and 'always' is set. Returns whether a report went out.
+static bool send_report(bool always)
+{
+    buttons_t local = prev_buttons;
+    buttons_t remote = prev_buttons >> 8;
+
+    // Reports carry the time of their edge, and unchanged reports the
+    // latest sample.
+    uint32_t decided_us = sample_us;
+    edge_t edge, link_edge;
+    bool const local_queued = edge_queue_peek(&report_edges, &edge);
+    bool const link_queued = edge_queue_peek(&link_edges, &link_edge);
+    if(link_queued && (!local_queued || (int32_t)(link_edge.time_us - edge.time_us) < 0))
+    {
+        edge_queue_pop(&link_edges, &edge);
+        remote = edge.buttons;
+        decided_us = edge.time_us;
+    }
+    else if(local_queued)
+    {
+        edge_queue_pop(&report_edges, &edge);
+        local = edge.buttons;
+        decided_us = edge.time_us;
+    }
+
+    uint16_t const buttons = local | (remote << 8);
+    uint16_t const changed = prev_buttons ^ buttons;
+
+    if(!changed && !always)
+        return false;
+    report_pending = false;
+    prev_buttons = buttons;
+
+    struct buttons_report const report =
+    {
+        .buttons = { buttons, buttons >> 8 },
+        .time_us = { decided_us, decided_us >> 8 },
+    };
+
+    // Both reports are built in this pass. With both enabled, the keyboard
+    // report follows from tud_hid_report_complete_cb().
+    // The keymap only covers this pad's buttons.
+    keyboard_build(&keyboard, local, config.keys);
+
+    if(config.report_mode & REPORT_MODE_GAMEPAD)
+    {
+        tud_hid_report(REPORT_ID_BUTTONS, &report, sizeof(report));
+        keyboard_pending = config.report_mode & REPORT_MODE_KEYBOARD;
+    }
+    else if(config.report_mode & REPORT_MODE_KEYBOARD)
+        tud_hid_report(REPORT_ID_KEYBOARD, &keyboard, sizeof(keyboard));
+
+    sof_report_sent(decided_us);
+    return true;
+}
+
+// Samples every 250 us, a slot of that at a time with the adaptive
+// schedule, and sends a report every ms the buttons changed.
+// Sampling doesn't wait for the endpoint: edges queue up in report_edges,
+// and the secondary's in link_edges, while it's busy, unmounted or
+// suspended, and tud_hid_report_complete_cb()
+// sends the next one as soon as the previous report is out.
 void hid_task(void)
 {
-    if(!tud_hid_ready())
+    if(tud_suspended())
+    {
+        suspend_task();
         return;
+    }
 
+    bool const final_pass = sof_pass_due(time_us_32());
+
+    // Starting from 0 makes the first pass run at once, so that the
+    // report sent on mount is already decided on a real sample.
     static absolute_time_t prev_time = 0;
-    if(!prev_time)
-        prev_time = get_absolute_time();
     absolute_time_t const time = get_absolute_time();
     int64_t const time_diff = absolute_time_diff_us(prev_time, time);
-    if(time_diff >= 250)
+    if(final_pass || time_diff >= poll_interval_us())
     {
         poll_sensors();
         prev_time = time;
     }
 
-    static uint32_t prev_millis = 0;
-    uint32_t const millis = board_millis();
+    if(config.link_role == LINK_PRIMARY)
+        remote_buttons = link_poll(time_us_32());
 
-    if(prev_millis == millis) 
+    if(!tud_hid_ready())
         return;
-    prev_millis = millis;
 
-    uint8_t const buttons = read_buttons();
+    static uint32_t prev_millis = 0;
+    uint32_t const millis = board_millis();
 
-    if(prev_buttons == buttons)
-        return;
-    prev_buttons = buttons;
+    if(sof_locked())
+    {
+        // Report once per frame, right before the host polls.
+        if(!final_pass)
+            return;
+    }
+    else
+    {
+        if(prev_millis == millis) 
+            return;
+        prev_millis = millis;
+    }
 
-    tud_hid_report(REPORT_ID_BUTTONS, &buttons, sizeof(buttons));
+    send_report(report_pending || (config.report_mode & REPORT_MODE_STREAM) || report_stream);
 }
 
 // Invoked when sent REPORT successfully to host
@@ -222,6 +537,33 @@ void hid_task(void)
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
 {
+    uint32_t const now = time_us_32();
+
+    // A follow-up keyboard report isn't the one the pass was timed for.
+    if(report[0] != REPORT_ID_KEYBOARD || !(config.report_mode & REPORT_MODE_GAMEPAD))
+    {
+        sof_report_complete(now);
+
+        if(wake_us)
+        {
+            stats.wake_latency_us = now - wake_us;
+            wake_us = 0;
+        }
+
+        if(!stats.boot_report_us)
+            stats.boot_report_us = now;
+    }
+
+    if(keyboard_pending)
+    {
+        keyboard_pending = false;
+        tud_hid_report(REPORT_ID_KEYBOARD, &keyboard, sizeof(keyboard));
+    }
+    else
+    {
+        // Drain the edges that queued up while the endpoint was busy.
+        send_report(false);
+    }
 }
 
 // Invoked when received GET_REPORT control request
@@ -232,12 +574,11 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
     if(report_type != HID_REPORT_TYPE_FEATURE)
         return 0;
 
-    if(report_id == REPORT_ID_FEATURES && reqlen >= sizeof(sensors) + sizeof(thresholds))
-    {
-        memcpy(buffer, &thresholds, sizeof(thresholds));
-        memcpy(buffer+sizeof(thresholds), &sensors, sizeof(sensors));
-        return sizeof(sensors) + sizeof(thresholds);
-    }
+    if(report_id == REPORT_ID_FEATURES)
+        return features_get_report(buffer, reqlen);
+
+    if(report_id == REPORT_ID_COMMAND)
+        return command_get_report(buffer, reqlen);
 
   return 0;
 }
@@ -250,13 +591,7 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_
         return;
 
     if(report_id == REPORT_ID_FEATURES)
-    {
-        if(bufsize >= sizeof(thresholds))
-        {
-            int const cmp = memcmp(&thresholds, buffer, sizeof(thresholds));
-            memcpy(&thresholds, buffer, sizeof(thresholds));
-            if(cmp != 0)
-                save_thresholds();
-        }
-    }
+        features_set_report(buffer, bufsize);
+    else if(report_id == REPORT_ID_COMMAND)
+        command_set_report(buffer, bufsize);
 }
@@ -0,0 +1,29 @@
+#ifndef PAD_H_
+#define PAD_H_
+
+#include <stdint.h>
+
+// The board is picked at build time, with PAD_BOARD in CMake.
+#ifndef PAD_BOARD_HEADER
+#define PAD_BOARD_HEADER "boards/pubby_pad.h"
+#endif
+#include PAD_BOARD_HEADER
+
+// The RP2040 has four ADC inputs for sensors, and the config is laid out for four buttons.
+#define MAX_BUTTONS 4
+#define NUM_BUTTONS PAD_NUM_BUTTONS
+
+_Static_assert(NUM_BUTTONS >= 1 && NUM_BUTTONS <= MAX_BUTTONS, "Boards have 1 to 4 buttons");
+
+// Completely unrolls a loop over the buttons.
+#define UNROLL_BUTTONS _Pragma("GCC unroll 4")
+
+typedef uint8_t force_t;
+typedef uint8_t buttons_t;
+
+#define ALL_BUTTONS ((buttons_t)((1 << NUM_BUTTONS) - 1))
+
+// Filtered sensor readings.
+extern force_t sensors[NUM_BUTTONS];
+
+#endif /* PAD_H_ */
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "pipeline.h"
+#include "config.h"
+#include "curve.h"
+#include "crosstalk.h"
+#include "thermal.h"
+#include "filter.h"
+#include "stats.h"
+#include "capture.h"
+
+force_t sensors[NUM_BUTTONS];
+debounce_t debouncer;
+uint32_t edge_us = 0;
+edge_queue_t report_edges = { .overflows = &stats.report_overflows, .coalesced = &stats.report_coalesced };
+edge_queue_t light_edges;
+
+static force_t forces[NUM_BUTTONS]; // Last reading of each channel, before crosstalk.
+static buttons_t raw_buttons = 0;
+static buttons_t seeded = 0; // Channels the filter has had a reading of.
+
+// The filter for passes that hold some channels, or before every channel
+// has been read. Held channels have nothing new to blend in, so each
+// channel's filter only steps on its own readings. A channel's first
+// reading seeds it, so that the first reports after boot aren't decided on
+// a filter still settling.
+static void filter_fresh(force_t const* readings, buttons_t held)
+{
+    force_t kept[NUM_BUTTONS];
+    memcpy(kept, sensors, sizeof(kept));
+    filter_sensors(sensors, readings);
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        buttons_t const channel = 1 << i;
+        if(held & channel)
+            sensors[i] = kept[i];
+        else if(!(seeded & channel))
+            sensors[i] = readings[i];
+    }
+    seeded |= ~held & ALL_BUTTONS;
+}
+
+void pipeline_run(uint16_t const* raw, buttons_t held, uint8_t const* before, uint32_t sample_us)
+{
+    UNROLL_BUTTONS
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        if(!(held & (1 << i)))
+            forces[i] = force_lut[i][(uint8_t)~(raw[i] >> 4)];
+
+    force_t readings[NUM_BUTTONS];
+    memcpy(readings, forces, sizeof(readings));
+    crosstalk_apply(readings, before);
+
+    if(!held && seeded == ALL_BUTTONS)
+        filter_sensors(sensors, readings);
+    else
+        filter_fresh(readings, held);
+
+    raw_buttons = filter_buttons(sensors, effective_thresholds, raw_buttons);
+
+    buttons_t const prev = debouncer.buttons;
+    if(debounce(&debouncer, raw_buttons, held, &config.debounce) != prev)
+    {
+        edge_us = sample_us;
+        capture_edges(prev, debouncer.buttons, sample_us);
+        edge_queue_push(&report_edges, debouncer.buttons, sample_us);
+        edge_queue_push(&light_edges, debouncer.buttons, sample_us);
+    }
+    else
+    {
+        edge_queue_flush(&report_edges);
+        edge_queue_flush(&light_edges);
+    }
+}
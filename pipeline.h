@@ -0,0 +1,23 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+#include "debounce.h"
+#include "edge_queue.h"
+
+// Decision pipeline of a sample pass: raw ADC codes in, debounced buttons
+// out. It has no hardware dependencies, so the host build runs the same code.
+
+extern debounce_t debouncer;
+extern uint32_t edge_us; // Sample the debounced buttons last changed on.
+extern edge_queue_t report_edges; // Every edge, until it's reported.
+extern edge_queue_t light_edges;  // Every edge, for the lights. Queueing is all they cost a pass.
+
+// Runs a pass on one raw 12-bit code per channel, sampled at 'sample_us'.
+// Channels in 'held' weren't converted: they keep their last reading, and
+// their filter and debounce don't step. 'before' goes to crosstalk_apply().
+void pipeline_run(uint16_t const* raw, buttons_t held, uint8_t const* before, uint32_t sample_us);
+
+#endif /* PIPELINE_H_ */
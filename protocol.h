@@ -0,0 +1,311 @@
+// Wire formats shared by the firmware and the host tools.
+// All multi-byte fields are little-endian.
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdint.h>
+
+//--------------------------------------------------------------------+
+// Input reports
+//--------------------------------------------------------------------+
+
+// REPORT_ID_BUTTONS
+struct buttons_report
+{
+    uint8_t buttons[2]; // Bits 0-7: this pad. Bits 8-15: a linked secondary pad.
+    uint8_t time_us[2]; // Device clock (low 16 bits) of the sample the buttons were decided on.
+};
+
+_Static_assert(sizeof(struct buttons_report) == 4, "buttons_report must be packed");
+
+//--------------------------------------------------------------------+
+// Command protocol (REPORT_ID_COMMAND)
+//--------------------------------------------------------------------+
+
+// A SET_REPORT carries a batch of operations:
+//
+//   struct command_header, then 'count' times:
+//   uint8_t opcode, uint8_t arg, uint8_t len, 'len' bytes of data
+//
+// The whole batch is validated before any of it runs, so a bad batch
+// changes nothing. Writes run when the batch arrives. Reads run on every
+// GET_REPORT that follows, so a host can poll by repeating GET_REPORT.
+// The response is:
+//
+//   struct command_header, then 'count' times:
+//   uint8_t opcode, uint8_t status, uint8_t len, 'len' bytes of data
+//
+// A rejected batch answers with a single result carrying the failing
+// opcode and its status.
+
+#define COMMAND_VERSION 1
+
+// Size of the REPORT_ID_COMMAND feature report, excluding the report ID.
+#define COMMAND_REPORT_SIZE 63
+
+// Most data a single operation can carry or return.
+#define COMMAND_DATA_MAX (COMMAND_REPORT_SIZE - sizeof(struct command_header) - 3)
+
+struct command_header
+{
+    uint8_t version;
+    uint8_t count;
+};
+
+enum
+{
+    OP_GET,         // arg: FIELD_*. Returns the field.
+    OP_SET,         // arg: FIELD_*, data: the new value. Takes effect at once, or STATUS_BAD_VALUE if out of range.
+    OP_GET_STATS,   // arg: byte offset. Returns as much of pad_stats as fits.
+    OP_RESET_STATS, // Clears counters and maxima, but not the boot timings and mount-time benchmarks.
+    OP_CAPTURE,     // arg: CAPTURE_CMD_*, data: uint16_t value.
+    OP_GET_CAPTURE, // Returns the next flight recorder chunk.
+    OP_COMMIT,      // Saves changed profiles to flash. Also done after a few idle seconds.
+    OP_COUNT
+};
+
+enum
+{
+    STATUS_OK,
+    STATUS_BAD_VERSION,
+    STATUS_BAD_OP,
+    STATUS_BAD_FIELD,
+    STATUS_BAD_LENGTH,
+    STATUS_READ_ONLY,
+    STATUS_NO_SPACE, // The results wouldn't fit in the response.
+    STATUS_BAD_VALUE, // OP_SET with a value out of the field's range.
+};
+
+enum
+{
+    FIELD_INFO,             // struct pad_info, read-only
+    FIELD_SENSORS,          // uint8_t per button, read-only
+    FIELD_THRESHOLDS,       // uint8_t per button
+    FIELD_KEYS,             // Keyboard usage per button, 0 for none.
+    FIELD_REPORT_MODE,      // uint8_t, REPORT_MODE_* bits
+    FIELD_DEBOUNCE,         // struct debounce_field
+    FIELD_SOF_LOCK,         // struct sof_lock_field, not saved
+    FIELD_CAPTURE_TRIGGERS, // struct capture_triggers_field, not saved
+    FIELD_CURVES,           // uint8_t[num_buttons][CURVE_KNOTS]
+    FIELD_LINK_ROLE,        // uint8_t, LINK_*
+    FIELD_ADC_DISCARD,      // uint8_t, conversions thrown away after each mux switch, up to ADC_DISCARD_MAX
+    FIELD_ADC_OVERSAMPLE,   // uint8_t, conversions averaged per reading (0 means 1), up to ADC_OVERSAMPLE_MAX
+    FIELD_CROSSTALK,        // int8_t[num_buttons + num_buttons * (num_buttons - 1) / 2]
+    FIELD_TEMP_COMP,        // int8_t reference in °C, then int8_t per button
+    FIELD_TEMPERATURE,      // int16_t in 1/16 °C, read-only, INT16_MIN before the first reading
+    FIELD_EXCITATION,       // struct excitation_field
+    FIELD_LIGHTS,           // struct lights_field
+    FIELD_PROFILE,          // uint8_t, the active profile, below PROFILE_COUNT
+    FIELD_SCHEDULE,         // struct schedule_field
+    FIELD_STREAM,           // uint8_t, nonzero to report every frame whatever the report mode; not saved
+    FIELD_COUNT
+};
+
+struct pad_info
+{
+    uint8_t command_version;
+    uint8_t num_buttons;
+};
+
+// Which input reports the pad sends.
+enum
+{
+    REPORT_MODE_GAMEPAD  = 1 << 0,
+    REPORT_MODE_KEYBOARD = 1 << 1,
+    REPORT_MODE_STREAM   = 1 << 2, // Report every frame, not just on changes.
+};
+
+// Every saved field belongs to a profile. Setting FIELD_PROFILE switches
+// to another at once; the one left keeps its unsaved changes. Holding
+// every panel for PROFILE_CHORD_MS switches to the next profile too.
+#define PROFILE_COUNT 4
+#define PROFILE_CHORD_MS 3000
+
+// Role of the pad in a linked pair.
+enum
+{
+    LINK_OFF,
+    LINK_PRIMARY,   // Reports the secondary's buttons as buttons 9-16.
+    LINK_SECONDARY, // Streams its buttons to the primary instead of reporting them.
+};
+
+// A force curve maps raw readings (inverted 8-bit ADC codes) to force.
+// Knot k is the force at code k * CURVE_STEP, except the last one, which
+// is at code 255. Readings between knots are interpolated linearly.
+#define CURVE_KNOTS 9
+#define CURVE_STEP 32
+
+// Each channel is converted right after the previous one, so the first
+// conversions after the mux switches can carry some of the previous
+// channel's voltage.
+#define ADC_DISCARD_MAX 3
+#define ADC_OVERSAMPLE_MAX 8
+
+// Crosstalk coefficients are subtracted from each reading before it's
+// filtered, in 1/256ths of the other channel's force. First comes one per
+// channel for the channel converted before it, whichever the schedule
+// made that (in the fixed order, channel 0's is the last one), then one
+// per pair of panels flexing together, in the order (0,1), (0,2), ...,
+// (1,2), ...
+
+// Thresholds follow the die temperature: each moves by its slope, in
+// 1/16ths per °C, away from the reference temperature. Setting the
+// thresholds moves the reference to the current temperature.
+
+struct debounce_field
+{
+    uint8_t min_press;   // In samples of the button's channel, 0 to disable.
+    uint8_t min_release; // In samples of the button's channel, 0 to disable.
+    uint8_t flags;       // Bit 0: defer releases instead of locking out presses.
+};
+
+struct sof_lock_field
+{
+    uint8_t enable;
+    uint8_t reserved;
+    uint16_t lead_min_us; // 0 for the default.
+};
+
+// How the FSR dividers are powered.
+enum
+{
+    EXCITE_ALWAYS, // Always on, with the regulator in its low-noise mode.
+    EXCITE_PULSED, // Only around each pass's conversions, after settling.
+};
+
+#define EXCITE_SETTLE_MAX_US 100
+
+struct excitation_field
+{
+    uint8_t mode;      // EXCITE_*
+    uint8_t settle_us; // Pulsed: from power on to the first conversion, up to EXCITE_SETTLE_MAX_US.
+};
+
+// Which channels a pass converts. A pass always takes one reading per
+// channel, so its conversion time doesn't change; the adaptive schedule
+// moves readings from idle channels to busy ones, near their threshold or
+// moving fast. It spreads the pass's readings over it, one slot every
+// SAMPLE_US / num_buttons, so a busy channel with several slots is sampled
+// and decided that much more often. Idle channels hold their last reading
+// between the passes that convert them. Each channel's filter and debounce
+// step on its own readings only.
+enum
+{
+    SCHEDULE_FIXED,    // Every channel, once a pass.
+    SCHEDULE_ADAPTIVE,
+};
+
+#define SCHEDULE_FLOOR_MAX 8
+
+struct schedule_field
+{
+    uint8_t mode;   // SCHEDULE_*
+    uint8_t floor;  // Idle channels are read one pass in this many, up to SCHEDULE_FLOOR_MAX. 0 means 1.
+    uint8_t near;   // A channel this close to its threshold, in force, is busy.
+    uint8_t motion; // So is one whose force moved this much since the last pass. 0 to disable.
+};
+
+// Panel lighting.
+enum
+{
+    LIGHTS_OFF,
+    LIGHTS_PRESS, // A panel lights while pressed, then fades out.
+};
+
+struct lights_field
+{
+    uint8_t mode;      // LIGHTS_*
+    uint8_t fade_time; // After a release, in 10 ms units. 0 goes dark at once.
+    uint8_t color[3];  // Red, green, blue at full brightness.
+};
+
+struct capture_triggers_field
+{
+    uint8_t triggers; // CAPTURE_TRIGGER_* bits
+    uint8_t reserved;
+    uint16_t short_edge_ms;
+};
+
+_Static_assert(sizeof(struct command_header) == 2, "command_header must be packed");
+_Static_assert(sizeof(struct pad_info) == 2, "pad_info must be packed");
+_Static_assert(sizeof(struct debounce_field) == 3, "debounce_field must be packed");
+_Static_assert(sizeof(struct sof_lock_field) == 4, "sof_lock_field must be packed");
+_Static_assert(sizeof(struct capture_triggers_field) == 4, "capture_triggers_field must be packed");
+_Static_assert(sizeof(struct excitation_field) == 2, "excitation_field must be packed");
+_Static_assert(sizeof(struct lights_field) == 5, "lights_field must be packed");
+_Static_assert(sizeof(struct schedule_field) == 4, "schedule_field must be packed");
+
+//--------------------------------------------------------------------+
+// Flight recorder (OP_CAPTURE, OP_GET_CAPTURE)
+//--------------------------------------------------------------------+
+
+enum
+{
+    CAPTURE_ARMED,     // Recording, waiting for a trigger.
+    CAPTURE_TRIGGERED, // Recording the frames that follow a trigger.
+    CAPTURE_FROZEN,    // Window is complete and can be downloaded.
+};
+
+// Trigger sources. Also used as the trigger mask.
+enum
+{
+    CAPTURE_TRIGGER_EDGE  = 1 << 0, // Any button edge.
+    CAPTURE_TRIGGER_SHORT = 1 << 1, // A press shorter than 'short_edge_ms'.
+    CAPTURE_TRIGGER_HOST  = 1 << 2, // Requested with CAPTURE_CMD_TRIGGER.
+};
+
+enum
+{
+    CAPTURE_CMD_SEEK,    // The next OP_GET_CAPTURE returns chunk 'value'.
+    CAPTURE_CMD_TRIGGER, // Trigger now.
+    CAPTURE_CMD_REARM,   // Discard the frozen window and start recording.
+};
+
+// Returned by OP_GET_CAPTURE, followed by 'frames' frames of
+// (2 + channels) uint16_t each: a microsecond timestamp (low 16 bits),
+// a mask of the channels the pass held rather than converted, then the
+// raw 12-bit ADC code of every channel, 0 for held ones.
+// Each read advances to the next chunk.
+struct capture_header
+{
+    uint8_t state;
+    uint8_t reason;        // Trigger source of the frozen window.
+    uint8_t channels;
+    uint8_t frames;        // Frames in this chunk.
+    uint16_t chunk;
+    uint16_t num_chunks;
+    uint16_t trigger_frame; // Window-relative frame the trigger fired on.
+};
+
+_Static_assert(sizeof(struct capture_header) == 10, "capture_header must be packed");
+
+//--------------------------------------------------------------------+
+// Instrumentation (OP_GET_STATS)
+//--------------------------------------------------------------------+
+
+struct pad_stats
+{
+    uint32_t sof_phase_us;    // IN token phase, measured from the SOF.
+    uint32_t sof_lead_us;     // The final pass runs this long before the IN token.
+    uint32_t sof_late;        // Reports that missed the IN token they were timed for.
+    uint32_t data_age_us;     // Age of the last report's sample when the host took it.
+    uint32_t data_age_max_us;
+    uint32_t wake_latency_us; // From a wake-up press or resume to the first report.
+    uint32_t boot_enum_us;    // From reset to the host configuring the device.
+    uint32_t boot_report_us;  // From reset to the host taking the first report.
+    uint32_t filter_scalar_cycles; // Cycles per filter pass, timed at mount.
+    uint32_t filter_swar_cycles;
+    uint32_t filter_interp_cycles;
+    uint32_t link_frames;     // Good frames received from a linked secondary.
+    uint32_t link_errors;     // Bytes skipped while looking for a frame.
+    uint32_t sample_pass_us;  // From powering the sensors to the last conversion of a pass, or of a slot when adaptive.
+    uint32_t adc_noise;       // Mean change between passes of released buttons' codes, in 1/16ths.
+    uint32_t light_push_cycles; // Cycles an edge spends queueing for the lights, timed at mount.
+    uint32_t light_latency_us;  // From the last edge's sample to the start of the frame showing it.
+    uint32_t report_overflows;  // Times the report queue filled up while the endpoint was busy.
+    uint32_t report_coalesced;  // Edges merged into others while it was full.
+    uint32_t decision_rate_hz[4]; // Decisions per second on a fresh reading of each channel, over the last second. 0 past num_buttons.
+};
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+
+#include "schedule.h"
+#include "config.h"
+#include "thermal.h"
+#include "stats.h"
+
+#define RATE_WINDOW_US 1000000
+
+static bool primed = false; // Every channel has been read once.
+static force_t prev_sensors[NUM_BUTTONS];
+static uint8_t pass = 0;    // Counts up to the floor, to stagger idle channels.
+static uint8_t turn = 0;    // Last channel handed a spare reading.
+static uint32_t counts[NUM_BUTTONS];
+static uint32_t window_us = 0;
+
+// Channels near their threshold, or moving fast enough to get there soon.
+static buttons_t busy_channels(void)
+{
+    struct schedule_field const* const schedule = &config.schedule;
+    buttons_t busy = 0;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        if(abs(sensors[i] - effective_thresholds[i]) <= schedule->near
+           || (schedule->motion && abs(sensors[i] - prev_sensors[i]) >= schedule->motion))
+            busy |= 1 << i;
+        prev_sensors[i] = sensors[i];
+    }
+    return busy;
+}
+
+void schedule_count(buttons_t converted, uint32_t now_us)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+        counts[i] += (converted >> i) & 1;
+
+    uint32_t const elapsed_us = now_us - window_us;
+    if(elapsed_us < RATE_WINDOW_US)
+        return;
+    window_us = now_us;
+
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        stats.decision_rate_hz[i] = (uint64_t)counts[i] * 1000000 / elapsed_us;
+        counts[i] = 0;
+    }
+}
+
+void schedule_plan(uint8_t* slots)
+{
+    buttons_t const busy = busy_channels();
+    unsigned const floor = MIN(MAX(config.schedule.floor, 1), SCHEDULE_FLOOR_MAX);
+    bool const adaptive = config.schedule.mode == SCHEDULE_ADAPTIVE && busy && primed;
+    primed = true;
+
+    if(++pass >= floor)
+        pass = 0;
+
+    // Idle channels take turns on their floor passes, so that their
+    // readings don't all land on the same pass.
+    uint8_t reads[NUM_BUTTONS];
+    int spare = 0;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        if(!adaptive || busy & (1 << i))
+            reads[i] = 1;
+        else
+        {
+            reads[i] = (pass + i) % floor == 0;
+            spare += 1 - reads[i];
+        }
+    }
+
+    // Busy channels share the rest in turn; there's at least one.
+    while(spare > 0)
+    {
+        turn = (turn + 1) % NUM_BUTTONS;
+        if(busy & (1 << turn))
+        {
+            ++reads[turn];
+            --spare;
+        }
+    }
+
+    // Deal the slots out a lap of the channels at a time, so that a busy
+    // channel's readings spread over the pass instead of bunching up.
+    int channel = NUM_BUTTONS - 1;
+    for(int slot = 0; slot < NUM_BUTTONS; ++slot)
+    {
+        do
+            channel = (channel + 1) % NUM_BUTTONS;
+        while(!reads[channel]);
+        --reads[channel];
+        slots[slot] = channel;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef SCHEDULE_H_
+#define SCHEDULE_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+
+// Spreads a pass's NUM_BUTTONS conversion slots over the channels,
+// following config.schedule. It has no hardware dependencies; the caller
+// converts.
+
+// Plans a pass from the filtered forces of the last one: the channel each
+// slot converts. A channel without a slot keeps its last reading.
+void schedule_plan(uint8_t* slots);
+
+// Counts the channels converted by a slot or pass into
+// stats.decision_rate_hz.
+void schedule_count(buttons_t converted, uint32_t now_us);
+
+#endif /* SCHEDULE_H_ */
@@ -0,0 +1,147 @@
+// Host test of the sensor filters: the packed-lane and interpolator
+// implementations must match the scalar reference bit for bit.
+// Every blend and threshold decision is checked exhaustively per lane,
+// then whole passes run on random readings and thresholds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/interp.h"
+#include "hardware/structs/systick.h"
+
+#include "filter.h"
+#include "stats.h"
+
+#define RANDOM_PASSES 1000000
+
+struct pad_stats stats;
+interp_hw_t sim_interp0;
+systick_hw_t sim_systick;
+
+static int failures = 0;
+
+static void fail(char const* what, long pass, force_t const* expected, force_t const* got, int count)
+{
+    if(++failures > 10)
+        return;
+    printf("%s differs at pass %ld:", what, pass);
+    for(int i = 0; i < count; ++i)
+        printf(" %u/%u", expected[i], got[i]);
+    printf(" (expected/got)\n");
+}
+
+// Every (filtered, reading) pair, in every lane at once.
+static void test_blend(void)
+{
+    for(int s = 0; s < 256; ++s)
+    {
+        for(int n = 0; n < 256; ++n)
+        {
+            force_t readings[NUM_BUTTONS];
+            force_t scalar[NUM_BUTTONS], swar[NUM_BUTTONS], interp[NUM_BUTTONS];
+            for(int i = 0; i < NUM_BUTTONS; ++i)
+            {
+                // Neighbouring lanes get other values, to catch carries between them.
+                readings[i] = i % 2 ? 255 - n : n;
+                scalar[i] = swar[i] = interp[i] = i % 2 ? 255 - s : s;
+            }
+
+            filter_sensors_scalar(scalar, readings);
+            filter_sensors_swar(swar, readings);
+            filter_sensors_interp(interp, readings);
+
+            if(memcmp(scalar, swar, sizeof(scalar)))
+                fail("Packed blend", s * 256 + n, scalar, swar, NUM_BUTTONS);
+            if(memcmp(scalar, interp, sizeof(scalar)))
+                fail("Interpolator blend", s * 256 + n, scalar, interp, NUM_BUTTONS);
+        }
+    }
+}
+
+// Every (filtered, threshold, previous state) for each lane on its own.
+static void test_hysteresis(void)
+{
+    for(int lane = 0; lane < NUM_BUTTONS; ++lane)
+    {
+        for(int s = 0; s < 256; ++s)
+        {
+            for(int t = 0; t < 256; ++t)
+            {
+                force_t sensors[NUM_BUTTONS] = { 0 };
+                force_t thresholds[NUM_BUTTONS] = { 0 };
+                sensors[lane] = s;
+                thresholds[lane] = t;
+
+                for(int prev = 0; prev < 2; ++prev)
+                {
+                    buttons_t const buttons = prev << lane;
+                    force_t const expected = filter_buttons_scalar(sensors, thresholds, buttons);
+                    force_t const got = filter_buttons_swar(sensors, thresholds, buttons);
+                    if(expected != got)
+                        fail("Packed hysteresis", (lane * 256 + s) * 256 + t, &expected, &got, 1);
+                }
+            }
+        }
+    }
+}
+
+// Whole passes, as the pipeline runs them.
+static void test_random(void)
+{
+    force_t scalar[NUM_BUTTONS] = { 0 }, swar[NUM_BUTTONS] = { 0 }, interp[NUM_BUTTONS] = { 0 };
+    force_t readings[NUM_BUTTONS];
+    force_t thresholds[NUM_BUTTONS];
+    buttons_t scalar_buttons = 0, swar_buttons = 0;
+
+    for(long pass = 0; pass < RANDOM_PASSES; ++pass)
+    {
+        if(pass % 1000 == 0)
+            for(int i = 0; i < NUM_BUTTONS; ++i)
+                thresholds[i] = rand();
+
+        // Mostly small steps, so the filter spends time near the thresholds.
+        for(int i = 0; i < NUM_BUTTONS; ++i)
+            readings[i] = rand() % 8 ? thresholds[i] + rand() % 16 - 8 : rand();
+
+        filter_sensors_scalar(scalar, readings);
+        filter_sensors_swar(swar, readings);
+        filter_sensors_interp(interp, readings);
+        scalar_buttons = filter_buttons_scalar(scalar, thresholds, scalar_buttons);
+        swar_buttons = filter_buttons_swar(scalar, thresholds, swar_buttons);
+
+        if(memcmp(scalar, swar, sizeof(scalar)))
+        {
+            fail("Packed pass", pass, scalar, swar, NUM_BUTTONS);
+            memcpy(swar, scalar, sizeof(swar));
+        }
+        if(memcmp(scalar, interp, sizeof(scalar)))
+        {
+            fail("Interpolator pass", pass, scalar, interp, NUM_BUTTONS);
+            memcpy(interp, scalar, sizeof(interp));
+        }
+        if(scalar_buttons != swar_buttons)
+        {
+            fail("Packed buttons", pass, &scalar_buttons, &swar_buttons, 1);
+            swar_buttons = scalar_buttons;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    srand(argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+    filter_interp_init();
+
+    test_blend();
+    test_hysteresis();
+    test_random();
+
+    if(failures)
+    {
+        printf("%d failures\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("Filters match on %d buttons\n", NUM_BUTTONS);
+    return EXIT_SUCCESS;
+}
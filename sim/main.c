@@ -0,0 +1,500 @@
+// Copyright 2024, Patrick Bene
+
+// Virtual pad for Linux. Registers the firmware's report descriptor with
+// uhid, answers feature reports with the firmware's own handlers, and runs
+// the firmware's decision pipeline on replayed or synthetic ADC codes, so
+// the host tools can be exercised without a pad.
+
+// STD
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Linux
+#include <linux/uhid.h>
+
+// Firmware
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "protocol.h"
+#include "config.h"
+#include "curve.h"
+#include "crosstalk.h"
+#include "thermal.h"
+#include "command.h"
+#include "keyboard.h"
+#include "pipeline.h"
+#include "stats.h"
+
+#define SAMPLE_US 250
+#define REPORT_US 1000
+
+// Synthetic input, in raw 12-bit codes. Readings fall as the panel is pressed.
+#define SYNTH_IDLE 3900
+#define SYNTH_PRESSED 1500
+#define SYNTH_NOISE 40
+#define SYNTH_PERIOD 2000 // Samples per cycle through all panels.
+#define SYNTH_HOLD 200    // Samples each press lasts.
+#define SYNTH_RAMP 20     // Samples to reach full force.
+
+extern tusb_desc_device_t const desc_device;
+
+struct pad_stats stats;
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+
+static char const* flash_path = "sim-flash.bin";
+static char const* serial = "SIM0000000000001";
+static FILE* trace = NULL;
+static int uhid = -1;
+static bool opened = false;
+static bool report_pending = false;
+static volatile sig_atomic_t quit = 0;
+
+//--------------------------------------------------------------------+
+// Firmware environment
+//--------------------------------------------------------------------+
+
+uint32_t time_us_32(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+void pico_get_unique_board_id_string(char* id_out, uint len)
+{
+    snprintf(id_out, len, "%s", serial);
+}
+
+// There is no SOF to lock to, so sof.c always reports unlocked.
+void tud_sof_cb_enable(bool en)
+{
+    (void)en;
+}
+
+static void store_flash(void)
+{
+    FILE* const fp = fopen(flash_path, "wb");
+    if(!fp || fwrite(sim_flash, sizeof(sim_flash), 1, fp) != 1)
+        fprintf(stderr, "pubby-sim: can't write %s: %s\n", flash_path, strerror(errno));
+    if(fp)
+        fclose(fp);
+}
+
+static void load_flash(void)
+{
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+
+    FILE* const fp = fopen(flash_path, "rb");
+    if(!fp)
+        return;
+    if(fread(sim_flash, sizeof(sim_flash), 1, fp) != 1)
+        memset(sim_flash, 0xFF, sizeof(sim_flash));
+    fclose(fp);
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    memset(sim_flash + flash_offs, 0xFF, count);
+    store_flash();
+}
+
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        sim_flash[flash_offs + i] &= data[i];
+    store_flash();
+}
+
+//--------------------------------------------------------------------+
+// Input
+//--------------------------------------------------------------------+
+
+// Reads one trace row of NUM_BUTTONS raw codes, looping at the end.
+// Rows are separated by newlines and codes by commas or spaces.
+// Lines starting with '#' are skipped.
+static bool read_trace(uint16_t* raw)
+{
+    char line[256];
+    for(bool rewound = false;;)
+    {
+        if(!fgets(line, sizeof(line), trace))
+        {
+            if(rewound)
+                return false;
+            rewind(trace);
+            rewound = true;
+            continue;
+        }
+
+        if(line[0] == '#')
+            continue;
+
+        char* str = line;
+        int i = 0;
+        for(; i < NUM_BUTTONS; ++i)
+        {
+            char* end;
+            long const code = strtol(str, &end, 10);
+            if(end == str)
+                break;
+            raw[i] = code < 0 ? 0 : code > 4095 ? 4095 : code;
+            str = end + strspn(end, ", \t");
+        }
+
+        if(i == NUM_BUTTONS)
+            return true;
+    }
+}
+
+// Presses each panel in turn, ramping up and down, over a noisy idle level.
+static void synthesize(uint16_t* raw, uint32_t pass)
+{
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        uint32_t const t = (pass + SYNTH_PERIOD - i * SYNTH_PERIOD / NUM_BUTTONS) % SYNTH_PERIOD;
+
+        int force = 0;
+        if(t < SYNTH_RAMP)
+            force = t * 256 / SYNTH_RAMP;
+        else if(t < SYNTH_HOLD)
+            force = 256;
+        else if(t < SYNTH_HOLD + SYNTH_RAMP)
+            force = (SYNTH_HOLD + SYNTH_RAMP - t) * 256 / SYNTH_RAMP;
+
+        int const noise = rand() % (2 * SYNTH_NOISE + 1) - SYNTH_NOISE;
+        raw[i] = SYNTH_IDLE - (SYNTH_IDLE - SYNTH_PRESSED) * force / 256 + noise;
+    }
+}
+
+//--------------------------------------------------------------------+
+// uhid
+//--------------------------------------------------------------------+
+
+static bool uhid_send(struct uhid_event const* ev)
+{
+    ssize_t const written = write(uhid, ev, sizeof(*ev));
+    if(written != sizeof(*ev))
+    {
+        fprintf(stderr, "pubby-sim: uhid write failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// The report descriptor's length is only kept in the configuration
+// descriptor, in the HID descriptor's wDescriptorLength.
+static uint16_t report_descriptor_size(void)
+{
+    uint8_t const* desc = tud_descriptor_configuration_cb(0);
+    uint16_t const total = desc[2] | (desc[3] << 8);
+
+    for(uint16_t i = 0; i < total; i += desc[i])
+        if(desc[i + 1] == HID_DESC_TYPE_HID)
+            return desc[i + 7] | (desc[i + 8] << 8);
+    return 0;
+}
+
+// Converts a string descriptor back to ASCII.
+static void descriptor_string(char* str, size_t size, uint8_t index)
+{
+    uint16_t const* desc = tud_descriptor_string_cb(index, 0x0409);
+    size_t const count = ((desc[0] & 0xFF) - 2) / 2;
+
+    size_t i = 0;
+    for(; i < count && i + 1 < size; ++i)
+        str[i] = desc[1 + i];
+    str[i] = '\0';
+}
+
+static bool uhid_create(void)
+{
+    struct uhid_event ev = { .type = UHID_CREATE2 };
+
+    descriptor_string((char*)ev.u.create2.name, sizeof(ev.u.create2.name), 2);
+    strncat((char*)ev.u.create2.name, " (virtual)", sizeof(ev.u.create2.name) - strlen((char*)ev.u.create2.name) - 1);
+    snprintf((char*)ev.u.create2.phys, sizeof(ev.u.create2.phys), "pubby-sim");
+    descriptor_string((char*)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), 3);
+
+    ev.u.create2.rd_size = report_descriptor_size();
+    memcpy(ev.u.create2.rd_data, tud_hid_descriptor_report_cb(0), ev.u.create2.rd_size);
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = desc_device.idVendor;
+    ev.u.create2.product = desc_device.idProduct;
+    ev.u.create2.version = desc_device.bcdDevice;
+
+    return uhid_send(&ev);
+}
+
+static void uhid_report(uint8_t report_id, void const* report, uint16_t len)
+{
+    struct uhid_event ev = { .type = UHID_INPUT2 };
+    ev.u.input2.size = 1 + len;
+    ev.u.input2.data[0] = report_id;
+    memcpy(ev.u.input2.data + 1, report, len);
+    uhid_send(&ev);
+}
+
+// Same dispatch as tud_hid_get_report_cb().
+static void get_report(struct uhid_get_report_req const* req)
+{
+    struct uhid_event ev = { .type = UHID_GET_REPORT_REPLY };
+    uint8_t* const buffer = ev.u.get_report_reply.data;
+    uint16_t const reqlen = sizeof(ev.u.get_report_reply.data) - 1;
+    uint16_t len = 0;
+
+    if(req->rtype == UHID_FEATURE_REPORT)
+    {
+        if(req->rnum == REPORT_ID_FEATURES)
+            len = features_get_report(buffer + 1, reqlen);
+        else if(req->rnum == REPORT_ID_COMMAND)
+            len = command_get_report(buffer + 1, reqlen);
+    }
+
+    ev.u.get_report_reply.id = req->id;
+    ev.u.get_report_reply.err = len ? 0 : EIO;
+    ev.u.get_report_reply.size = len ? 1 + len : 0;
+    buffer[0] = req->rnum;
+    uhid_send(&ev);
+}
+
+// Same dispatch as tud_hid_set_report_cb(). The data starts with the report ID.
+static void set_report(struct uhid_set_report_req const* req)
+{
+    struct uhid_event ev = { .type = UHID_SET_REPORT_REPLY };
+
+    if(req->rtype == UHID_FEATURE_REPORT && req->size >= 1)
+    {
+        if(req->rnum == REPORT_ID_FEATURES)
+            features_set_report(req->data + 1, req->size - 1);
+        else if(req->rnum == REPORT_ID_COMMAND)
+            command_set_report(req->data + 1, req->size - 1);
+    }
+
+    ev.u.set_report_reply.id = req->id;
+    ev.u.set_report_reply.err = 0;
+    uhid_send(&ev);
+}
+
+static void uhid_task(void)
+{
+    struct pollfd pfd = { .fd = uhid, .events = POLLIN };
+    while(poll(&pfd, 1, 0) > 0)
+    {
+        struct uhid_event ev;
+        if(read(uhid, &ev, sizeof(ev)) <= 0)
+        {
+            quit = 1;
+            return;
+        }
+
+        switch(ev.type)
+        {
+        case UHID_OPEN:
+            // Like a mount, the first report goes out whether or not anything changed.
+            opened = true;
+            report_pending = true;
+            break;
+
+        case UHID_CLOSE:
+            opened = false;
+            break;
+
+        case UHID_GET_REPORT:
+            get_report(&ev.u.get_report);
+            break;
+
+        case UHID_SET_REPORT:
+            set_report(&ev.u.set_report);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+//--------------------------------------------------------------------+
+// Reports
+//--------------------------------------------------------------------+
+
+// The unlinked, unlocked path of the firmware's hid_task(). uhid would take
+// every report at once, but a real endpoint takes one per interval, so
+// this sends one report per tick. With both report modes, the keyboard
+// report takes the next tick, as it does from tud_hid_report_complete_cb().
+static keyboard_report_t keyboard;
+static bool keyboard_pending = false;
+
+static void send_report(buttons_t buttons, uint32_t decided_us)
+{
+    struct buttons_report const report =
+    {
+        .buttons = { buttons, 0 },
+        .time_us = { decided_us, decided_us >> 8 },
+    };
+
+    keyboard_build(&keyboard, buttons, config.keys);
+
+    if(config.report_mode & REPORT_MODE_GAMEPAD)
+    {
+        uhid_report(REPORT_ID_BUTTONS, &report, sizeof(report));
+        keyboard_pending = config.report_mode & REPORT_MODE_KEYBOARD;
+    }
+    else if(config.report_mode & REPORT_MODE_KEYBOARD)
+        uhid_report(REPORT_ID_KEYBOARD, &keyboard, sizeof(keyboard));
+}
+
+// Like the firmware, takes the oldest queued edge each time the endpoint
+// is free, so a burst of edges backs up in report_edges and coalesces
+// once it fills.
+static void report_task(uint32_t sample_us)
+{
+    static buttons_t prev_buttons = 0;
+
+    if(!opened)
+        return;
+
+    if(keyboard_pending)
+    {
+        keyboard_pending = false;
+        uhid_report(REPORT_ID_KEYBOARD, &keyboard, sizeof(keyboard));
+        return;
+    }
+
+    buttons_t buttons = prev_buttons;
+    uint32_t decided_us = sample_us;
+    edge_t edge;
+    if(edge_queue_pop(&report_edges, &edge))
+    {
+        buttons = edge.buttons;
+        decided_us = edge.time_us;
+    }
+
+    bool const always = report_pending || (config.report_mode & REPORT_MODE_STREAM) || report_stream;
+    if(buttons == prev_buttons && !always)
+        return;
+    report_pending = false;
+    prev_buttons = buttons;
+    send_report(buttons, decided_us);
+}
+
+//--------------------------------------------------------------------+
+// Main
+//--------------------------------------------------------------------+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static void usage(FILE* fp)
+{
+    fprintf(fp,
+        "usage: pubby-sim [-t trace.csv] [-f flash.bin] [-s serial]\n"
+        "\n"
+        "  -t trace.csv  replay raw ADC codes, one row of %d per %d us sample,\n"
+        "                looping at the end (default: synthetic presses)\n"
+        "  -f flash.bin  where the config sector is kept (default: %s)\n"
+        "  -s serial     serial number to report, up to 16 characters\n"
+        "                (default: %s)\n",
+        NUM_BUTTONS, SAMPLE_US, flash_path, serial);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "t:f:s:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 't':
+            trace = fopen(optarg, "r");
+            if(!trace)
+            {
+                fprintf(stderr, "pubby-sim: can't open %s: %s\n", optarg, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            flash_path = optarg;
+            break;
+        case 's':
+            serial = optarg;
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    load_flash();
+    read_config();
+    curve_update();
+    crosstalk_update();
+    thermal_update();
+
+    uhid = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if(uhid < 0)
+    {
+        fprintf(stderr, "pubby-sim: can't open /dev/uhid: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if(!uhid_create())
+        return EXIT_FAILURE;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for(uint32_t pass = 0; !quit; ++pass)
+    {
+        next.tv_nsec += SAMPLE_US * 1000;
+        if(next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            ++next.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        uhid_task();
+
+        uint16_t raw[NUM_BUTTONS];
+        if(!trace)
+            synthesize(raw, pass);
+        else if(!read_trace(raw))
+        {
+            fprintf(stderr, "pubby-sim: trace has no rows of %d codes\n", NUM_BUTTONS);
+            break;
+        }
+
+        uint32_t const sample_us = time_us_32();
+        pipeline_run(raw, 0, NULL, sample_us);
+
+        if(pass % (REPORT_US / SAMPLE_US) == 0)
+            report_task(sample_us);
+
+        if(!debouncer.buttons)
+            config_task();
+    }
+
+    struct uhid_event const ev = { .type = UHID_DESTROY };
+    uhid_send(&ev);
+    close(uhid);
+    return EXIT_SUCCESS;
+}
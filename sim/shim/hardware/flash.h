@@ -0,0 +1,14 @@
+#ifndef SIM_HARDWARE_FLASH_H_
+#define SIM_HARDWARE_FLASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+
+// Like the real ones, these can only clear bits, and the erase sets them.
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count);
+
+#endif /* SIM_HARDWARE_FLASH_H_ */
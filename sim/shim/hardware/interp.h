@@ -0,0 +1,50 @@
+#ifndef SIM_HARDWARE_INTERP_H_
+#define SIM_HARDWARE_INTERP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/stdlib.h"
+
+// Enough of interp0 for the sensor blend: lane 0 in blend mode, lane 1
+// signed or not. Going through interp0 recomputes PEEK1 from the bases,
+// as reading it does on the chip.
+
+typedef struct
+{
+    bool blend;
+    bool is_signed;
+} interp_config;
+
+typedef struct
+{
+    uint32_t accum[2];
+    uint32_t base[3];
+    uint32_t peek[3];
+    interp_config ctrl[2];
+} interp_hw_t;
+
+extern interp_hw_t sim_interp0;
+
+static inline interp_hw_t* sim_interp_update(interp_hw_t* interp)
+{
+    // PEEK1 = BASE0 + alpha * (BASE1 - BASE0), alpha being ACCUM1[7:0] / 256.
+    // Without blending, lane 1 just adds; shifts and masks aren't modelled.
+    uint32_t const alpha = interp->accum[1] & 0xFF;
+    if(!interp->ctrl[0].blend)
+        interp->peek[1] = interp->base[1] + interp->accum[1];
+    else if(interp->ctrl[1].is_signed)
+        interp->peek[1] = (int32_t)interp->base[0] + (((int32_t)interp->base[1] - (int32_t)interp->base[0]) * (int32_t)alpha >> 8);
+    else
+        interp->peek[1] = interp->base[0] + (uint32_t)(((int64_t)interp->base[1] - interp->base[0]) * alpha >> 8);
+    return interp;
+}
+
+#define interp0 (sim_interp_update(&sim_interp0))
+
+static inline interp_config interp_default_config(void) { return (interp_config){ false, false }; }
+static inline void interp_config_set_blend(interp_config* cfg, bool blend) { cfg->blend = blend; }
+static inline void interp_config_set_signed(interp_config* cfg, bool is_signed) { cfg->is_signed = is_signed; }
+static inline void interp_set_config(interp_hw_t* interp, uint lane, interp_config* cfg) { interp->ctrl[lane] = *cfg; }
+
+#endif /* SIM_HARDWARE_INTERP_H_ */
@@ -0,0 +1,24 @@
+#ifndef SIM_HARDWARE_STRUCTS_SYSTICK_H_
+#define SIM_HARDWARE_STRUCTS_SYSTICK_H_
+
+#include <stdint.h>
+
+// A SysTick that never ticks: timings on the host read 0 cycles.
+
+typedef struct
+{
+    uint32_t csr;
+    uint32_t rvr;
+    uint32_t cvr;
+    uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t sim_systick;
+
+#define systick_hw (&sim_systick)
+
+#define M0PLUS_SYST_CSR_ENABLE_BITS 0x1
+#define M0PLUS_SYST_CSR_CLKSOURCE_BITS 0x4
+#define M0PLUS_SYST_RVR_BITS 0x00FFFFFF
+
+#endif /* SIM_HARDWARE_STRUCTS_SYSTICK_H_ */
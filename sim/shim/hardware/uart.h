@@ -0,0 +1,22 @@
+#ifndef SIM_HARDWARE_UART_H_
+#define SIM_HARDWARE_UART_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico/stdlib.h"
+
+// The simulator has no pad link: nothing is sent, nothing arrives.
+
+typedef struct uart_inst uart_inst_t;
+
+#define uart0 ((uart_inst_t*)0)
+#define uart1 ((uart_inst_t*)1)
+
+static inline uint uart_init(uart_inst_t* uart, uint baudrate) { (void)uart; return baudrate; }
+static inline bool uart_is_readable(uart_inst_t* uart) { (void)uart; return false; }
+static inline char uart_getc(uart_inst_t* uart) { (void)uart; return 0; }
+static inline void uart_write_blocking(uart_inst_t* uart, uint8_t const* src, size_t len) { (void)uart; (void)src; (void)len; }
+
+#endif /* SIM_HARDWARE_UART_H_ */
@@ -0,0 +1,30 @@
+// Host stand-ins for the parts of the Pico SDK the shared firmware
+// sources use. Flash is an array in the simulator, holding only the
+// config sector.
+
+#ifndef SIM_PICO_STDLIB_H_
+#define SIM_PICO_STDLIB_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+extern uint8_t sim_flash[];
+
+#define XIP_BASE ((uintptr_t)sim_flash)
+#define PICO_FLASH_SIZE_BYTES 4096
+
+#define GPIO_FUNC_UART 2
+
+uint32_t time_us_32(void);
+
+static inline void gpio_set_function(uint gpio, int fn) { (void)gpio; (void)fn; }
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+
+#endif /* SIM_PICO_STDLIB_H_ */
@@ -0,0 +1,11 @@
+#ifndef SIM_PICO_UNIQUE_ID_H_
+#define SIM_PICO_UNIQUE_ID_H_
+
+#include "pico/stdlib.h"
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+// The simulator's serial, set with -s.
+void pico_get_unique_board_id_string(char* id_out, uint len);
+
+#endif /* SIM_PICO_UNIQUE_ID_H_ */
@@ -0,0 +1,115 @@
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "sof.h"
+#include "stats.h"
+
+#define FRAME_US 1000
+#define LEAD_MIN_US 40  // Covers a sampling and decision pass.
+#define LEAD_MAX_US 800
+#define LEAD_STEP_US 16 // Back-off after a late report.
+
+static bool enabled = false;
+static bool phase_valid = false;
+static bool pass_done = true;
+static bool report_timed = false;
+
+static uint32_t sof_us = 0;
+static uint32_t phase_x16 = 0; // Filtered IN token phase, in 1/16 us.
+static uint32_t lead_us = LEAD_MIN_US;
+static uint32_t lead_min_us = LEAD_MIN_US;
+static uint32_t expected_in_us = 0;
+static uint32_t sample_us = 0;
+
+// Invoked from tud_task() at every start of frame, while enabled.
+void tud_sof_cb(uint32_t frame_count)
+{
+    (void) frame_count;
+    sof_us = time_us_32();
+    pass_done = false;
+}
+
+void sof_lock(bool enable, uint32_t min_us)
+{
+    enabled = enable;
+    phase_valid = false;
+    lead_min_us = min_us ? min_us : LEAD_MIN_US;
+    lead_us = lead_min_us;
+    tud_sof_cb_enable(enable);
+}
+
+bool sof_locked(void)
+{
+    return enabled && phase_valid;
+}
+
+bool sof_pass_due(uint32_t now)
+{
+    if(!sof_locked() || pass_done)
+        return false;
+
+    // If the lead reaches back past the SOF, aim for the next frame's IN.
+    uint32_t const phase = phase_x16 >> 4;
+    uint32_t const offset = (phase + FRAME_US - lead_us) % FRAME_US;
+    uint32_t const target = sof_us + offset;
+
+    if((int32_t)(now - target) < 0)
+        return false;
+
+    pass_done = true;
+    expected_in_us = target + lead_us;
+    return true;
+}
+
+void sof_report_sent(uint32_t sample)
+{
+    sample_us = sample;
+    report_timed = sof_locked();
+}
+
+void sof_report_complete(uint32_t now)
+{
+    stats.data_age_us = now - sample_us;
+    if(stats.data_age_us > stats.data_age_max_us)
+        stats.data_age_max_us = stats.data_age_us;
+
+    if(!enabled)
+        return;
+
+    // Track the phase modulo the frame, so that jitter across the
+    // SOF boundary doesn't drag the average to the middle of the frame.
+    int32_t const phase_x16_now = ((now - sof_us) % FRAME_US) << 4;
+    if(!phase_valid)
+    {
+        phase_x16 = phase_x16_now;
+        phase_valid = true;
+    }
+    else
+    {
+        int32_t diff = phase_x16_now - (int32_t)phase_x16;
+        if(diff > (FRAME_US << 3))
+            diff -= FRAME_US << 4;
+        else if(diff < -(FRAME_US << 3))
+            diff += FRAME_US << 4;
+        phase_x16 = (phase_x16 + (FRAME_US << 4) + diff / 8) % (FRAME_US << 4);
+    }
+
+    // Missing the IN token costs a whole frame, so back off quickly
+    // and creep back towards the minimum lead.
+    if(report_timed)
+    {
+        if((int32_t)(now - expected_in_us) > FRAME_US / 2)
+        {
+            ++stats.sof_late;
+            lead_us += LEAD_STEP_US;
+            if(lead_us > LEAD_MAX_US)
+                lead_us = LEAD_MAX_US;
+        }
+        else if(lead_us > lead_min_us)
+            --lead_us;
+        report_timed = false;
+    }
+
+    stats.sof_phase_us = phase_x16 >> 4;
+    stats.sof_lead_us = lead_us;
+}
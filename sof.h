@@ -0,0 +1,23 @@
+#ifndef SOF_H_
+#define SOF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// SOF phase lock. The host polls the interrupt endpoint at a fixed phase
+// within each 1 ms frame. Report completions tell us that phase, so the
+// final sampling and decision pass of each frame can be scheduled to finish
+// just before the IN token, instead of at a random point in the frame.
+
+void sof_lock(bool enable, uint32_t lead_min_us);
+
+// True once the IN token phase has been measured.
+bool sof_locked(void);
+
+// True once per frame, when the final pass should run.
+bool sof_pass_due(uint32_t now);
+
+void sof_report_sent(uint32_t sample_us);
+void sof_report_complete(uint32_t now);
+
+#endif /* SOF_H_ */
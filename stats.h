@@ -0,0 +1,8 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "protocol.h"
+
+extern struct pad_stats stats;
+
+#endif /* STATS_H_ */
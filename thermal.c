@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "thermal.h"
+#include "config.h"
+
+// The sensor reads 706 mV at 27 °C, falling 1.721 mV per °C.
+#define SENSOR_27C_UV 706000
+#define SENSOR_UV_PER_C 1721
+
+force_t effective_thresholds[NUM_BUTTONS];
+int16_t temperature = TEMPERATURE_UNKNOWN;
+
+static force_t prev_thresholds[NUM_BUTTONS];
+static bool updated = false;
+
+void thermal_sample(uint16_t raw)
+{
+    int32_t const uv = raw * (3300000 / 16) / 256; // 3.3 V full scale over 4096 codes.
+    int32_t const sample = 27 * 16 - (uv - SENSOR_27C_UV) * 16 / SENSOR_UV_PER_C;
+
+    // Single conversions are a couple of degrees apart.
+    if(temperature == TEMPERATURE_UNKNOWN)
+        temperature = sample;
+    else
+        temperature += (sample - temperature) / 8;
+
+    thermal_update();
+}
+
+void thermal_update(void)
+{
+    if(updated && temperature != TEMPERATURE_UNKNOWN
+       && memcmp(prev_thresholds, config.thresholds, sizeof(prev_thresholds)) != 0)
+    {
+        config.temp_comp.reference = (temperature + 8) >> 4;
+    }
+    memcpy(prev_thresholds, config.thresholds, sizeof(prev_thresholds));
+    updated = true;
+
+    int32_t const delta = (temperature == TEMPERATURE_UNKNOWN) ? 0 : temperature - config.temp_comp.reference * 16;
+    for(int i = 0; i < NUM_BUTTONS; ++i)
+    {
+        int32_t const threshold = config.thresholds[i] + config.temp_comp.slopes[i] * delta / 256;
+        effective_thresholds[i] = threshold < 0 ? 0 : threshold > 255 ? 255 : threshold;
+    }
+}
+
+void thermal_reload(void)
+{
+    updated = false;
+    thermal_update();
+}
@@ -0,0 +1,32 @@
+#ifndef THERMAL_H_
+#define THERMAL_H_
+
+#include <stdint.h>
+
+#include "pad.h"
+
+// Temperature compensation. FSRs and the ADC drift as a cabinet warms up,
+// so the thresholds buttons are decided on follow the RP2040's on-chip
+// temperature sensor, by a slope per sensor from config.temp_comp.
+
+#define TEMPERATURE_UNKNOWN INT16_MIN
+
+// The thresholds in effect.
+extern force_t effective_thresholds[NUM_BUTTONS];
+
+// Filtered die temperature in 1/16 °C.
+extern int16_t temperature;
+
+// Takes a conversion of the temperature sensor, ADC input 4.
+void thermal_sample(uint16_t raw);
+
+// Recomputes the thresholds in effect. Run when the thresholds or the
+// compensation change. Thresholds that changed since the last run are
+// taken to be set at the current temperature.
+void thermal_update(void);
+
+// Same, but keeps the reference temperature. Run when a whole config
+// is swapped in, e.g. on a profile switch.
+void thermal_reload(void);
+
+#endif /* THERMAL_H_ */
@@ -95,4 +95,7 @@
 #define CFG_TUD_CDC               0
 #define CFG_TUD_MSC               0
 
+// HID buffer size, large enough for the biggest feature report
+#define CFG_TUD_HID_EP_BUFSIZE    64
+
 #endif
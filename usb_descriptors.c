@@ -26,6 +26,8 @@
 #include "pico/unique_id.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "protocol.h"
+#include "keyboard.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
@@ -73,6 +75,16 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
+// A byte of buttons from usage 'first': as many as the board has,
+// then padding. This pad's buttons start at 1, a linked pad's at 9.
+#define BUTTON_BYTE(first) \
+    HID_USAGE_MIN      ( first                                  ) , \
+    HID_USAGE_MAX      ( first + NUM_BUTTONS - 1                ) , \
+    HID_REPORT_COUNT   ( NUM_BUTTONS                            ) , \
+    HID_INPUT          ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) , \
+    HID_REPORT_COUNT   ( 8 - NUM_BUTTONS                        ) , \
+    HID_INPUT          ( HID_CONSTANT                           )
+
 uint8_t const desc_hid_report[] =
 {
     // Buttons
@@ -81,13 +93,38 @@ uint8_t const desc_hid_report[] =
     HID_COLLECTION ( HID_COLLECTION_APPLICATION )                 ,
     HID_REPORT_ID(REPORT_ID_BUTTONS)
     HID_USAGE_PAGE     ( HID_USAGE_PAGE_BUTTON                  ) ,
-    HID_USAGE_MIN      ( 1                                      ) ,
-    HID_USAGE_MAX      ( 8                                      ) ,
+    HID_LOGICAL_MIN    ( 0                                      ) ,
+    HID_LOGICAL_MAX    ( 1                                      ) ,
+    HID_REPORT_SIZE    ( 1                                      ) ,
+    BUTTON_BYTE        ( 1                                      ) ,
+    BUTTON_BYTE        ( 9                                      ) ,
+    // Device timestamp
+    HID_USAGE_PAGE_N   ( HID_USAGE_PAGE_VENDOR, 2               ) ,
+    HID_USAGE          ( 0x01                                   ) ,
+    HID_LOGICAL_MIN    ( 0                                      ) ,
+    HID_LOGICAL_MAX_N  ( 0xFF, 2                                ) ,
+    HID_REPORT_SIZE    ( 8                                      ) ,
+    HID_REPORT_COUNT   ( 2                                      ) ,
+    HID_INPUT          ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,
+  HID_COLLECTION_END,
+
+    // NKRO keyboard
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP     )                 ,
+    HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD )                 ,
+    HID_COLLECTION ( HID_COLLECTION_APPLICATION )                 ,
+    HID_REPORT_ID(REPORT_ID_KEYBOARD)
+    HID_USAGE_PAGE     ( HID_USAGE_PAGE_KEYBOARD                ) ,
+    HID_USAGE_MIN      ( 0xE0                                   ) ,
+    HID_USAGE_MAX      ( 0xE7                                   ) ,
     HID_LOGICAL_MIN    ( 0                                      ) ,
     HID_LOGICAL_MAX    ( 1                                      ) ,
     HID_REPORT_SIZE    ( 1                                      ) ,
     HID_REPORT_COUNT   ( 8                                      ) ,
     HID_INPUT          ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,
+    HID_USAGE_MIN      ( 0                                      ) ,
+    HID_USAGE_MAX      ( NKRO_KEYS - 1                          ) ,
+    HID_REPORT_COUNT   ( NKRO_KEYS                              ) ,
+    HID_INPUT          ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,
   HID_COLLECTION_END,
 
     // Sensors
@@ -96,12 +133,21 @@ uint8_t const desc_hid_report[] =
     HID_COLLECTION     ( HID_COLLECTION_APPLICATION ),
     HID_REPORT_ID(REPORT_ID_FEATURES)
     HID_USAGE_MIN      ( 1                                      ) ,
-    HID_USAGE_MAX      ( 8                                      ) ,
+    HID_USAGE_MAX      ( 2 * NUM_BUTTONS                        ) , // Thresholds, then sensors.
     HID_LOGICAL_MIN    ( 0                                      ) ,
     HID_LOGICAL_MAX    ( 0xFF                                   ) ,
     HID_REPORT_SIZE    ( 8                                      ) ,
-    HID_REPORT_COUNT   ( 8                                      ) ,
+    HID_REPORT_COUNT   ( 2 * NUM_BUTTONS                        ) ,
     HID_FEATURE        (HID_DATA | HID_VARIABLE | HID_ABSOLUTE | HID_WRAP_NO | HID_LINEAR |HID_PREFERRED_STATE | HID_NO_NULL_POSITION | HID_NON_VOLATILE),
+
+    // Command protocol
+    HID_REPORT_ID(REPORT_ID_COMMAND)
+    HID_USAGE          ( 0xA1                                   ) ,
+    HID_LOGICAL_MIN    ( 0                                      ) ,
+    HID_LOGICAL_MAX    ( 0xFF                                   ) ,
+    HID_REPORT_SIZE    ( 8                                      ) ,
+    HID_REPORT_COUNT   ( COMMAND_REPORT_SIZE                    ) ,
+    HID_FEATURE        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,
   HID_COLLECTION_END,
 };
 
@@ -131,7 +177,7 @@ enum
 uint8_t const desc_configuration[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
-  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0, 100),
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
   TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1)
@@ -29,6 +29,8 @@ enum
 {
   REPORT_ID_BUTTONS = 1,
   REPORT_ID_FEATURES,
+  REPORT_ID_KEYBOARD,
+  REPORT_ID_COMMAND,
   REPORT_ID_COUNT
 };
 